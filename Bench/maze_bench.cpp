@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <nlohmann/json.hpp>
+#include "../Source/maze.h"
+#include "../Source/maze_generator.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using json = nlohmann::json;
+
+// Times the core Maze operations on generated mazes of 1k up to 1M
+// junctions. Every operation is timed one call at a time, for throughput
+// and latency percentiles, next to the peak memory of the process. The
+// results go to a JSON file to compare between commits.
+//
+// Usage: MazeBench [--max-scale <junctions>] [--grid hash|chunked] [--json <file>] [--label <text>]
+
+struct BenchResult {
+    string op;
+    int scale;
+    size_t count;
+    double seconds;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    long memoryKb;
+    long peakKb;
+};
+
+static long MemoryKb()
+{
+    // Resident set size right now, from the pages in /proc/self/statm.
+    long pages = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == nullptr)
+        return 0;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return resident * 4;
+}
+
+static long PeakMemoryKb()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+// Results of the timed calls are added up here and printed at the end,
+// so the compiler cannot drop calls whose result is otherwise unused.
+static size_t sink = 0;
+
+// Calls op(i) count times and times every call on its own.
+template <typename F>
+static BenchResult Measure(string name, int scale, size_t count, F op)
+{
+    vector<double> latencies(count);
+    double total = 0;
+    for (size_t i = 0; i < count; i++) {
+        auto start = chrono::steady_clock::now();
+        op(i);
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        latencies[i] = ns;
+        total += ns;
+    }
+    sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) { return latencies[min(count-1, (size_t)(q*count))]; };
+
+    BenchResult r = { name, scale, count, total / 1e9, at(0.5), at(0.9), at(0.99), latencies.back(), MemoryKb(), PeakMemoryKb() };
+    printf("%8d %-16s %9zu %12.1f %10.0f %10.0f %10.0f %12.0f %10ld %10ld\n", r.scale, r.op.c_str(), r.count,
+        r.count / r.seconds, r.p50, r.p90, r.p99, r.max, r.memoryKb, r.peakKb);
+    fflush(stdout);
+    return r;
+}
+
+static void RunScale(int scale, GridBackend grid, vector<BenchResult> &results)
+{
+    mt19937 rng(scale);
+    MazeGeneratorSettings settings;
+    settings.algorithm = MAZE_KRUSKAL;
+    settings.seed = scale;
+    settings.width = (int)ceil(sqrt((double)scale));
+    settings.height = (scale + settings.width - 1) / settings.width;
+    settings.idBase = 1;
+    vector<JunctionRecord> records;
+    vector<Tunnel> tunnels;
+    MazeGenerator(settings).Generate(records, tunnels);
+    records.resize(scale);
+    int spacing = settings.spacing;
+    int extentX = settings.width*spacing;
+    int extentY = settings.height*spacing;
+
+    Maze maze;
+    maze.verbose = false;
+    maze.SetGridBackend(grid);
+    vector<JunctionID> ids(scale);
+    vector<string> names(scale);
+    for (int i = 0; i < scale; i++)
+        names[i] = "J" + to_string(i);
+
+    results.push_back(Measure("AddJunction", scale, scale, [&](size_t i) {
+        Coord c = records[i].coord;
+        maze.AddJunction(c.x, c.y, names[i]);
+    }));
+    for (int i = 0; i < scale; i++)
+        ids[i] = maze.GetJunctionAt(records[i].coord.x, records[i].coord.y);
+
+    // The generator ids are idBase + index, the maze picked its own.
+    tunnels.erase(remove_if(tunnels.begin(), tunnels.end(), [&](Tunnel t) {
+        return t.from > scale || t.to > scale;
+    }), tunnels.end());
+    results.push_back(Measure("AddTunnel", scale, tunnels.size(), [&](size_t i) {
+        maze.AddTunnel(ids[tunnels[i].from-1], ids[tunnels[i].to-1]);
+    }));
+
+    size_t queries = min(scale, 100000);
+    uniform_int_distribution<int> pick(0, scale-1);
+    vector<Tunnel> candidates(queries);
+    for (Tunnel &t: candidates)
+        t = { ids[pick(rng)], ids[pick(rng)] };
+    results.push_back(Measure("IsValidTunnel", scale, queries, [&](size_t i) {
+        maze.IsValidTunnel(candidates[i]);
+    }));
+
+    vector<Coord> coords(queries);
+    uniform_int_distribution<int> pickX(-spacing, extentX), pickY(-spacing, extentY);
+    for (Coord &c: coords)
+        c = { pickX(rng), pickY(rng) };
+    results.push_back(Measure("GetJunctionAt", scale, queries, [&](size_t i) {
+        maze.GetJunctionAt(coords[i].x, coords[i].y);
+    }));
+    // Every cell of a window in row order, the way the renderer reads them.
+    results.push_back(Measure("ScanCells", scale, min(queries, (size_t)1000), [&](size_t i) {
+        JunctionID sum = 0;
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++)
+                sum += maze.GetJunctionAt(coords[i].x+x, coords[i].y+y);
+        }
+        sink += sum;
+    }));
+    results.push_back(Measure("GetTunnelAt", scale, queries, [&](size_t i) {
+        maze.GetTunnelAt(coords[i].x, coords[i].y);
+    }));
+
+    // A screen of cells, what the renderer asks for every frame.
+    vector<JunctionID> visibleJunctions;
+    vector<Tunnel> visibleTunnels;
+    results.push_back(Measure("QueryJunctions", scale, min(queries, (size_t)1000), [&](size_t i) {
+        maze.QueryJunctions(coords[i], { coords[i].x+100, coords[i].y+60 }, visibleJunctions);
+    }));
+    results.push_back(Measure("QueryTunnels", scale, min(queries, (size_t)1000), [&](size_t i) {
+        maze.QueryTunnels(coords[i], { coords[i].x+100, coords[i].y+60 }, visibleTunnels);
+    }));
+
+    // Grow a rectangle, then shrink it back on the next call.
+    results.push_back(Measure("SetJunctionRect", scale, queries, [&](size_t i) {
+        JunctionID id = ids[(i/2) % scale];
+        JunctionRect r = i % 2 == 0 ? JunctionRect({ -1, -1 }, { 2, 2 }) : JunctionRect({ 0, 0 }, { 1, 1 });
+        maze.SetJunctionRect(id, r);
+    }));
+
+    // Drawn up front, so the random numbers stay out of the timings.
+    vector<int> picks(queries);
+    for (int &p: picks)
+        p = pick(rng);
+    results.push_back(Measure("FindJunction", scale, queries, [&](size_t i) {
+        sink += maze.FindJunction(names[picks[i]]);
+    }));
+
+    // Every cell next to a junction gets a few tags out of a small set,
+    // the way mazes are tagged in practice.
+    vector<string> vocabulary = { "spawn", "loot", "trap", "lit", "dark", "water", "exit", "shop" };
+    for (int i = 0; i < 8; i++)
+        vocabulary.push_back("zone_" + to_string(i));
+    vector<vector<string>> tagLists(scale);
+    for (int i = 0; i < scale; i++) {
+        for (int k = 0; k < 1 + i % 3; k++)
+            tagLists[i].push_back(vocabulary[(i*7 + k*5) % vocabulary.size()]);
+    }
+    long memoryBefore = MemoryKb();
+    results.push_back(Measure("SetTagsAt", scale, scale, [&](size_t i) {
+        maze.SetTagsAt(records[i].coord.x+1, records[i].coord.y, tagLists[i]);
+    }));
+    printf("%8d %-16s %10ld KB\n", scale, "tag memory", MemoryKb() - memoryBefore);
+    results.push_back(Measure("GetTagsAt", scale, queries, [&](size_t i) {
+        Coord c = records[picks[i]].coord;
+        sink += maze.GetTagsAt(c.x+1, c.y).size();
+    }));
+    TagQuery tagQuery;
+    tagQuery.all = { "loot" };
+    tagQuery.none = { "trap" };
+    tagQuery.hasArea = true;
+    tagQuery.lo = { extentX/4, extentY/4 };
+    tagQuery.hi = { extentX/2, extentY/2 };
+    results.push_back(Measure("QueryTags", scale, min(queries, (size_t)1000), [&](size_t i) {
+        sink += maze.QueryTags(tagQuery).size();
+    }));
+
+    fs::path path = fs::temp_directory_path() / ("maze_bench_" + to_string(scale) + ".json");
+    results.push_back(Measure("ExportJson", scale, 1, [&](size_t i) {
+        maze.ExportJson(path);
+    }));
+    Maze loaded;
+    loaded.verbose = false;
+    loaded.SetGridBackend(grid);
+    results.push_back(Measure("ImportJson", scale, 1, [&](size_t i) {
+        loaded.ImportJson(path);
+    }));
+    fs::remove(path);
+
+    results.push_back(Measure("PruneJunctions", scale, 1, [&](size_t i) {
+        maze.PruneJunctions();
+    }));
+}
+
+int main(int argc, char **argv)
+{
+    int maxScale = 1000000;
+    fs::path jsonPath;
+    string label;
+    GridBackend grid = GRID_HASH;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-scale") == 0 && i+1 < argc) {
+            maxScale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--label") == 0 && i+1 < argc) {
+            label = argv[++i];
+        } else if (strcmp(argv[i], "--grid") == 0 && i+1 < argc && strcmp(argv[i+1], "hash") == 0) {
+            grid = GRID_HASH;
+            i++;
+        } else if (strcmp(argv[i], "--grid") == 0 && i+1 < argc && strcmp(argv[i+1], "chunked") == 0) {
+            grid = GRID_CHUNKED;
+            i++;
+        } else {
+            printf("Usage: %s [--max-scale <junctions>] [--grid hash|chunked] [--json <file>] [--label <text>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%8s %-16s %9s %12s %10s %10s %10s %12s %10s %10s\n", "scale", "operation", "count", "ops/s",
+        "p50(ns)", "p90(ns)", "p99(ns)", "max(ns)", "rss(KB)", "peak(KB)");
+    vector<BenchResult> results;
+    for (int scale: { 1000, 10000, 100000, 1000000 }) {
+        if (scale <= maxScale)
+            RunScale(scale, grid, results);
+    }
+    printf("checksum %zu\n", sink);
+
+    if (!jsonPath.empty()) {
+        json out;
+        out["label"] = label;
+        out["grid"] = grid == GRID_CHUNKED ? "chunked" : "hash";
+        out["results"] = json::array();
+        for (BenchResult &r: results) {
+            out["results"].push_back({
+                { "scale", r.scale }, { "op", r.op }, { "count", r.count }, { "seconds", r.seconds },
+                { "ops_per_second", r.count / r.seconds }, { "p50_ns", r.p50 }, { "p90_ns", r.p90 },
+                { "p99_ns", r.p99 }, { "max_ns", r.max }, { "rss_kb", r.memoryKb }, { "peak_rss_kb", r.peakKb },
+            });
+        }
+        ofstream file(jsonPath);
+        file << out.dump(2) << endl;
+        if (!file.good()) {
+            printf("Could not write %s\n", jsonPath.string().c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
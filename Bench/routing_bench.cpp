@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "../Source/maze.h"
+#include "../Source/maze_graph.h"
+#include "../Source/maze_router.h"
+#include "../Source/contraction_hierarchy.h"
+#include "../Source/maze_generator.h"
+
+// Compares point to point queries of the contraction hierarchy against
+// plain Dijkstra and A* on generated mazes of growing size. Every answer
+// of the hierarchy is checked against Dijkstra.
+//
+// Usage: RoutingBench [max junctions]
+
+static double Micros(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    int maxJunctions = argc > 1 ? atoi(argv[1]) : 1000000;
+    mt19937 rng(1234);
+
+    printf("%10s %10s %10s %12s %12s %12s\n", "junctions", "build(s)", "shortcuts", "dijkstra(us)", "astar(us)", "ch(us)");
+    for (int target: { 10000, 100000, 1000000 }) {
+        if (target > maxJunctions)
+            break;
+        MazeGeneratorSettings settings;
+        settings.algorithm = MAZE_KRUSKAL;
+        settings.seed = target;
+        settings.width = settings.height = (int)ceil(sqrt((double)target));
+        settings.loops = 0.1;
+        Maze maze;
+        MazeGenerator(settings).Generate(maze);
+        MazeGraph graph(maze);
+
+        auto start = chrono::steady_clock::now();
+        ContractionHierarchy ch;
+        ch.Build(graph);
+        double buildSeconds = Micros(start) / 1e6;
+
+        uniform_int_distribution<JunctionID> pick(graph.ids.front(), graph.ids.back());
+        vector<pair<JunctionID, JunctionID>> queries(100);
+        for (auto &q: queries)
+            q = { pick(rng), pick(rng) };
+
+        MazeRouter router;
+        router.SetGraph(&graph);
+        vector<JunctionID> path;
+        vector<uint32_t> expected;
+        start = chrono::steady_clock::now();
+        for (auto &q: queries)
+            expected.push_back(router.FindPath(q.first, q.second, path, false));
+        double dijkstra = Micros(start) / queries.size();
+
+        start = chrono::steady_clock::now();
+        for (auto &q: queries)
+            router.FindPath(q.first, q.second, path);
+        double astar = Micros(start) / queries.size();
+
+        start = chrono::steady_clock::now();
+        int wrong = 0;
+        for (int i = 0; i < queries.size(); i++)
+            wrong += ch.GetDistance(queries[i].first, queries[i].second) != expected[i];
+        double hierarchy = Micros(start) / queries.size();
+
+        // Unpacked paths must be real tunnels adding up to the distance.
+        for (int i = 0; i < queries.size(); i++) {
+            uint32_t length = ch.FindPath(queries[i].first, queries[i].second, path);
+            uint32_t sum = 0;
+            for (int k = 1; k < path.size(); k++) {
+                uint32_t a = graph.GetIndex(path[k-1]);
+                uint32_t b = graph.GetIndex(path[k]);
+                auto begin = graph.neighbors.begin() + graph.offsets[a];
+                auto end = graph.neighbors.begin() + graph.offsets[a+1];
+                auto it = lower_bound(begin, end, b);
+                if (it == end || *it != b) {
+                    sum = ROUTE_INFINITY;
+                    break;
+                }
+                sum += graph.lengths[it - graph.neighbors.begin()];
+            }
+            wrong += length != expected[i] || sum != length;
+        }
+
+        printf("%10u %10.2f %10u %12.1f %12.1f %12.2f\n", graph.Size(), buildSeconds, ch.ShortcutCount(),
+            dijkstra, astar, hierarchy);
+        if (wrong > 0) {
+            printf("%d queries disagree with Dijkstra\n", wrong);
+            return 1;
+        }
+    }
+    return 0;
+}
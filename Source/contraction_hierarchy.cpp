@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <queue>
+#include "contraction_hierarchy.h"
+#include "maze_router.h"
+
+// Witness searches give up after settling this many junctions. Missing a
+// witness only costs an unneeded shortcut, never a wrong distance.
+#define WITNESS_SETTLE_LIMIT 64
+
+ContractionHierarchy::ContractionHierarchy()
+{
+}
+
+void ContractionHierarchy::Build(MazeGraph &graph)
+{
+    uint32_t n = graph.Size();
+    ids = graph.ids;
+    indices = graph.indices;
+    shortcuts = 0;
+
+    // Working copy of the graph that collects the shortcuts.
+    vector<vector<Edge>> adj(n);
+    for (uint32_t v = 0; v < n; v++) {
+        for (uint32_t k = graph.offsets[v]; k < graph.offsets[v+1]; k++)
+            adj[v].push_back({ graph.neighbors[k], graph.lengths[k], GRAPH_NONE });
+    }
+    vector<char> contracted(n, 0);
+    vector<uint32_t> deletedNeighbors(n, 0);
+
+    // Scratch for the witness searches.
+    vector<uint32_t> witnessDist(n, ROUTE_INFINITY);
+    vector<uint32_t> touched;
+    vector<HeapItem> heap;
+    auto witness = [&](uint32_t source, uint32_t skip, uint32_t limit) {
+        for (uint32_t t: touched)
+            witnessDist[t] = ROUTE_INFINITY;
+        touched.clear();
+        heap.clear();
+        witnessDist[source] = 0;
+        touched.push_back(source);
+        heap.push_back({ 0, source });
+        int settled = 0;
+        while (heap.size() > 0 && settled < WITNESS_SETTLE_LIMIT) {
+            pop_heap(heap.begin(), heap.end());
+            HeapItem item = heap.back();
+            heap.pop_back();
+            if (item.key > witnessDist[item.node])
+                continue;
+            if (item.key > limit)
+                break;
+            settled++;
+            for (Edge &e: adj[item.node]) {
+                if (contracted[e.to] || e.to == skip)
+                    continue;
+                uint32_t d = item.key + e.length;
+                if (d < witnessDist[e.to]) {
+                    if (witnessDist[e.to] == ROUTE_INFINITY)
+                        touched.push_back(e.to);
+                    witnessDist[e.to] = d;
+                    heap.push_back({ d, e.to });
+                    push_heap(heap.begin(), heap.end());
+                }
+            }
+        }
+    };
+    auto addEdge = [&](uint32_t from, uint32_t to, uint32_t length, uint32_t middle) {
+        for (Edge &e: adj[from]) {
+            if (e.to == to) {
+                if (length < e.length)
+                    e = { to, length, middle };
+                return;
+            }
+        }
+        adj[from].push_back({ to, length, middle });
+    };
+
+    // Contracting v needs a shortcut between two of its neighbors when the
+    // path over v is the only shortest one. Returns the number of edges the
+    // contraction adds minus the number it removes.
+    vector<Edge> live;
+    auto contract = [&](uint32_t v, bool apply) {
+        live.clear();
+        for (Edge &e: adj[v]) {
+            if (!contracted[e.to])
+                live.push_back(e);
+        }
+        int added = 0;
+        for (int i = 0; i < live.size(); i++) {
+            uint32_t limit = 0;
+            for (int j = i+1; j < live.size(); j++)
+                limit = max(limit, live[i].length + live[j].length);
+            if (limit == 0)
+                continue;
+            witness(live[i].to, v, limit);
+            for (int j = i+1; j < live.size(); j++) {
+                uint32_t length = live[i].length + live[j].length;
+                if (witnessDist[live[j].to] <= length)
+                    continue;
+                added++;
+                if (apply) {
+                    addEdge(live[i].to, live[j].to, length, v);
+                    addEdge(live[j].to, live[i].to, length, v);
+                }
+            }
+        }
+        return added - (int)live.size();
+    };
+    auto priority = [&](uint32_t v) {
+        return contract(v, false) + (int)deletedNeighbors[v];
+    };
+
+    // Lazy updates: a popped junction is only contracted when its fresh
+    // priority still beats the next one in line.
+    priority_queue<pair<int, uint32_t>, vector<pair<int, uint32_t>>, greater<pair<int, uint32_t>>> order;
+    for (uint32_t v = 0; v < n; v++)
+        order.push({ priority(v), v });
+    rank.assign(n, 0);
+    uint32_t nextRank = 0;
+    while (!order.empty()) {
+        uint32_t v = order.top().second;
+        order.pop();
+        int p = priority(v);
+        if (!order.empty() && p > order.top().first) {
+            order.push({ p, v });
+            continue;
+        }
+        int before = 0;
+        for (Edge &e: adj[v])
+            before += !contracted[e.to];
+        shortcuts += contract(v, true) + before;
+        contracted[v] = 1;
+        rank[v] = nextRank++;
+        for (Edge &e: adj[v])
+            deletedNeighbors[e.to]++;
+    }
+
+    // Keep only the edges leading up the hierarchy.
+    upOffsets.assign(1, 0);
+    upEdges.clear();
+    for (uint32_t v = 0; v < n; v++) {
+        for (Edge &e: adj[v]) {
+            if (rank[e.to] > rank[v])
+                upEdges.push_back(e);
+        }
+        upOffsets.push_back(upEdges.size());
+    }
+
+    for (Search *s: { &forward, &backward }) {
+        s->dist.assign(n, 0);
+        s->parent.assign(n, 0);
+        s->parentEdge.assign(n, 0);
+        s->stamp.assign(n, 0);
+    }
+    query = 0;
+}
+
+void ContractionHierarchy::Relax(Search &s, uint32_t node, uint32_t d, uint32_t parent, uint32_t edge)
+{
+    if (s.stamp[node] == query && s.dist[node] <= d)
+        return;
+    s.stamp[node] = query;
+    s.dist[node] = d;
+    s.parent[node] = parent;
+    s.parentEdge[node] = edge;
+    s.heap.push_back({ d, node });
+    push_heap(s.heap.begin(), s.heap.end());
+}
+uint32_t ContractionHierarchy::Query(uint32_t source, uint32_t target, uint32_t &meet)
+{
+    query++;
+    if (query == 0) {
+        fill(forward.stamp.begin(), forward.stamp.end(), 0);
+        fill(backward.stamp.begin(), backward.stamp.end(), 0);
+        query = 1;
+    }
+    forward.heap.clear();
+    backward.heap.clear();
+    Relax(forward, source, 0, GRAPH_NONE, GRAPH_NONE);
+    Relax(backward, target, 0, GRAPH_NONE, GRAPH_NONE);
+
+    // Both searches climb until neither can still beat the best meeting.
+    uint32_t best = ROUTE_INFINITY;
+    meet = GRAPH_NONE;
+    while (true) {
+        uint32_t fKey = forward.heap.size() > 0 ? forward.heap.front().key : ROUTE_INFINITY;
+        uint32_t bKey = backward.heap.size() > 0 ? backward.heap.front().key : ROUTE_INFINITY;
+        if (min(fKey, bKey) >= best)
+            break;
+        Search &s = fKey <= bKey ? forward : backward;
+        Search &other = fKey <= bKey ? backward : forward;
+
+        pop_heap(s.heap.begin(), s.heap.end());
+        HeapItem item = s.heap.back();
+        s.heap.pop_back();
+        uint32_t node = item.node;
+        if (item.key > s.dist[node])
+            continue;
+
+        if (other.stamp[node] == query && (uint64_t)item.key + other.dist[node] < best) {
+            best = item.key + other.dist[node];
+            meet = node;
+        }
+        for (uint32_t k = upOffsets[node]; k < upOffsets[node+1]; k++)
+            Relax(s, upEdges[k].to, item.key + upEdges[k].length, node, k);
+    }
+    return best;
+}
+uint32_t ContractionHierarchy::FindUpEdge(uint32_t low, uint32_t high)
+{
+    for (uint32_t k = upOffsets[low]; k < upOffsets[low+1]; k++) {
+        if (upEdges[k].to == high)
+            return k;
+    }
+    return GRAPH_NONE;
+}
+void ContractionHierarchy::Unpack(uint32_t from, uint32_t to, uint32_t middle, vector<JunctionID> &path)
+{
+    // Appends the junctions after from up to and including to. A shortcut
+    // is the two edges from its middle junction, which has the lowest rank.
+    struct Step {
+        uint32_t from;
+        uint32_t to;
+        uint32_t middle;
+    };
+    vector<Step> stack = { { from, to, middle } };
+    while (stack.size() > 0) {
+        Step step = stack.back();
+        stack.pop_back();
+        if (step.middle == GRAPH_NONE) {
+            path.push_back(ids[step.to]);
+            continue;
+        }
+        Edge &first = upEdges[FindUpEdge(step.middle, step.from)];
+        Edge &second = upEdges[FindUpEdge(step.middle, step.to)];
+        stack.push_back({ step.middle, step.to, second.middle });
+        stack.push_back({ step.from, step.middle, first.middle });
+    }
+}
+
+uint32_t ContractionHierarchy::Size()
+{
+    return ids.size();
+}
+uint32_t ContractionHierarchy::ShortcutCount()
+{
+    return shortcuts;
+}
+uint32_t ContractionHierarchy::GetDistance(JunctionID from, JunctionID to)
+{
+    auto a = indices.find(from);
+    auto b = indices.find(to);
+    if (a == indices.end() || b == indices.end())
+        return ROUTE_INFINITY;
+    uint32_t meet;
+    return Query(a->second, b->second, meet);
+}
+uint32_t ContractionHierarchy::FindPath(JunctionID from, JunctionID to, vector<JunctionID> &path)
+{
+    path.clear();
+    auto a = indices.find(from);
+    auto b = indices.find(to);
+    if (a == indices.end() || b == indices.end())
+        return ROUTE_INFINITY;
+    uint32_t meet;
+    uint32_t length = Query(a->second, b->second, meet);
+    if (length == ROUTE_INFINITY)
+        return length;
+
+    // Up from the source to the meeting junction, then down to the target.
+    vector<uint32_t> up;
+    for (uint32_t node = meet; node != a->second; node = forward.parent[node])
+        up.push_back(node);
+    path.push_back(from);
+    uint32_t prev = a->second;
+    for (int i = up.size()-1; i >= 0; i--) {
+        uint32_t node = up[i];
+        Unpack(prev, node, upEdges[forward.parentEdge[node]].middle, path);
+        prev = node;
+    }
+    for (uint32_t node = meet; node != b->second; node = backward.parent[node]) {
+        uint32_t next = backward.parent[node];
+        Unpack(node, next, upEdges[backward.parentEdge[node]].middle, path);
+    }
+    return length;
+}
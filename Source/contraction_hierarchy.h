@@ -0,0 +1,67 @@
+#ifndef CONTRACTION_HIERARCHY_H
+#define CONTRACTION_HIERARCHY_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "maze_graph.h"
+
+using namespace std;
+
+// Contraction hierarchy over a maze graph, for point to point queries on
+// mazes far too big for a distance table.
+// Build() contracts the junctions one by one, least important first, and
+// adds a shortcut wherever a contraction would break a shortest path.
+// Queries then run a bidirectional Dijkstra that only climbs towards more
+// important junctions, which settles a tiny part of the maze. Shortcuts
+// remember the junction they skip, so paths unpack to real tunnels.
+class ContractionHierarchy {
+private:
+    struct Edge {
+        uint32_t to;
+        uint32_t length;
+        uint32_t middle;
+    };
+    struct HeapItem {
+        uint32_t key;
+        uint32_t node;
+        bool operator<(const HeapItem &other) const { return key > other.key; }
+    };
+    struct Search {
+        vector<uint32_t> dist;
+        vector<uint32_t> parent;
+        vector<uint32_t> parentEdge;
+        vector<uint32_t> stamp;
+        vector<HeapItem> heap;
+    };
+
+    // Upward graph, edges only lead to junctions contracted later.
+    vector<uint32_t> upOffsets;
+    vector<Edge> upEdges;
+    vector<uint32_t> rank;
+    vector<JunctionID> ids;
+    unordered_map<JunctionID, uint32_t> indices;
+    uint32_t shortcuts = 0;
+
+    Search forward;
+    Search backward;
+    uint32_t query = 0;
+
+    void Relax(Search &s, uint32_t node, uint32_t d, uint32_t parent, uint32_t edge);
+    uint32_t Query(uint32_t source, uint32_t target, uint32_t &meet);
+    uint32_t FindUpEdge(uint32_t low, uint32_t high);
+    void Unpack(uint32_t from, uint32_t to, uint32_t middle, vector<JunctionID> &path);
+
+public:
+    ContractionHierarchy();
+    void Build(MazeGraph &graph);
+
+    uint32_t Size();
+    uint32_t ShortcutCount();
+    uint32_t GetDistance(JunctionID from, JunctionID to);
+    // Fills path from start to end with every junction passed, returns the
+    // length or ROUTE_INFINITY when the junctions are not connected.
+    uint32_t FindPath(JunctionID from, JunctionID to, vector<JunctionID> &path);
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "distance_table.h"
+#include "maze_router.h"
+#include "file_writer.h"
+
+DistanceTable::DistanceTable()
+{
+}
+void DistanceTable::CopyGraph(MazeGraph &graph)
+{
+    ids = graph.ids;
+    offsets = graph.offsets;
+    neighbors = graph.neighbors;
+    lengths = graph.lengths;
+    indices = graph.indices;
+}
+void DistanceTable::Detach()
+{
+    // Rows that live in a mapped file are copied before they are changed.
+    if (dist == ownedDist.data())
+        return;
+    size_t n = ids.size();
+    ownedDist.assign(dist, dist + n*n);
+    ownedHops.assign(hops, hops + n*n);
+    dist = ownedDist.data();
+    hops = ownedHops.data();
+    file.Close();
+}
+void DistanceTable::BuildRows(MazeGraph &graph, vector<uint32_t> &sources, int threads)
+{
+    if (threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+    size_t n = graph.Size();
+    atomic<size_t> next = 0;
+
+    // Each worker owns a router and writes whole rows, so nothing is shared.
+    auto work = [&]() {
+        MazeRouter router;
+        router.SetGraph(&graph);
+        for (size_t i = next++; i < sources.size(); i = next++) {
+            uint32_t s = sources[i];
+            uint32_t *d = ownedDist.data() + s*n;
+            uint16_t *h = ownedHops.data() + s*n;
+            fill(d, d + n, ROUTE_INFINITY);
+            fill(h, h + n, TABLE_NO_HOP);
+
+            // Parents are settled before their children, so every hop is
+            // either the first step out of the source or inherited.
+            router.FindAll(s);
+            for (uint32_t node: router.GetSettled()) {
+                d[node] = router.GetDistance(node);
+                uint32_t p = router.GetParent(node);
+                if (p == GRAPH_NONE)
+                    continue;
+                if (p == s) {
+                    for (uint32_t k = graph.offsets[s]; k < graph.offsets[s+1]; k++) {
+                        if (graph.neighbors[k] == node)
+                            h[node] = k - graph.offsets[s];
+                    }
+                } else {
+                    h[node] = h[p];
+                }
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(work);
+    work();
+    for (thread &t: workers)
+        t.join();
+}
+
+bool DistanceTable::Build(MazeGraph &graph, int threads)
+{
+    uint32_t n = graph.Size();
+    for (uint32_t i = 0; i < n; i++) {
+        if (graph.Degree(i) >= TABLE_NO_HOP) {
+            printf("Junction %u has too many tunnels for a distance table\n", graph.ids[i]);
+            return false;
+        }
+    }
+
+    file.Close();
+    CopyGraph(graph);
+    ownedDist.assign((size_t)n*n, ROUTE_INFINITY);
+    ownedHops.assign((size_t)n*n, TABLE_NO_HOP);
+    dist = ownedDist.data();
+    hops = ownedHops.data();
+
+    vector<uint32_t> sources(n);
+    for (uint32_t i = 0; i < n; i++)
+        sources[i] = i;
+    BuildRows(graph, sources, threads);
+    return true;
+}
+int DistanceTable::Update(MazeGraph &graph, int threads)
+{
+    if (graph.ids != ids) {
+        if (!Build(graph, threads))
+            return 0;
+        return Size();
+    }
+    Detach();
+
+    // Diff the neighbor lists, both are sorted by index. A changed length
+    // counts as a removed and an added tunnel.
+    struct Change {
+        uint32_t u;
+        uint32_t v;
+        uint32_t w;
+        bool added;
+    };
+    vector<Change> changes;
+    uint32_t n = Size();
+    vector<char> affected(n, 0);
+    for (uint32_t u = 0; u < n; u++) {
+        uint32_t a = offsets[u], aEnd = offsets[u+1];
+        uint32_t b = graph.offsets[u], bEnd = graph.offsets[u+1];
+        while (a < aEnd || b < bEnd) {
+            uint32_t va = a < aEnd ? neighbors[a] : GRAPH_NONE;
+            uint32_t vb = b < bEnd ? graph.neighbors[b] : GRAPH_NONE;
+            if (va == vb && lengths[a] == graph.lengths[b]) {
+                a++;
+                b++;
+                continue;
+            }
+            // The neighbor slots of u moved, so its hops are invalid.
+            affected[u] = 1;
+            if (va <= vb) {
+                if (u < va)
+                    changes.push_back({ u, va, lengths[a], false });
+                a++;
+            }
+            if (vb <= va) {
+                if (u < vb)
+                    changes.push_back({ u, vb, graph.lengths[b], true });
+                b++;
+            }
+        }
+    }
+
+    // An added tunnel only matters to a source it gives a shorter path. A
+    // removed tunnel only matters when it is on the shortest path tree of
+    // the source, and the far end has no other neighbor just as close that
+    // is reached over the same first hop. Tree children share the hop of
+    // their parent, so tunnels whose ends have different hops are no tree
+    // edges.
+    for (uint32_t s = 0; s < n; s++) {
+        const uint32_t *d = dist + (size_t)s*n;
+        const uint16_t *h = hops + (size_t)s*n;
+        auto losesPath = [&](uint32_t from, uint32_t to) {
+            if (from != s && h[from] != h[to])
+                return false;
+            for (uint32_t k = graph.offsets[to]; k < graph.offsets[to+1]; k++) {
+                uint32_t x = graph.neighbors[k];
+                if (x != from && x != s && h[x] == h[to] && (uint64_t)d[x] + graph.lengths[k] == d[to])
+                    return false;
+            }
+            return true;
+        };
+        for (Change &c: changes) {
+            if (affected[s])
+                break;
+            uint64_t du = d[c.u];
+            uint64_t dv = d[c.v];
+            if (c.added)
+                affected[s] = du + c.w < dv || dv + c.w < du;
+            else if (du != ROUTE_INFINITY)
+                affected[s] = (du + c.w == dv && losesPath(c.u, c.v)) || (dv + c.w == du && losesPath(c.v, c.u));
+        }
+    }
+
+    vector<uint32_t> sources;
+    for (uint32_t s = 0; s < n; s++) {
+        if (affected[s])
+            sources.push_back(s);
+    }
+    CopyGraph(graph);
+    BuildRows(graph, sources, threads);
+    return sources.size();
+}
+
+uint32_t DistanceTable::Size()
+{
+    return ids.size();
+}
+uint32_t DistanceTable::GetDistance(JunctionID from, JunctionID to)
+{
+    auto a = indices.find(from);
+    auto b = indices.find(to);
+    if (a == indices.end() || b == indices.end())
+        return ROUTE_INFINITY;
+    return GetDistanceAt(a->second, b->second);
+}
+JunctionID DistanceTable::GetNextHop(JunctionID from, JunctionID to)
+{
+    auto a = indices.find(from);
+    auto b = indices.find(to);
+    if (a == indices.end() || b == indices.end())
+        return 0;
+    uint32_t hop = GetNextHopAt(a->second, b->second);
+    return hop != GRAPH_NONE ? ids[hop] : 0;
+}
+uint32_t DistanceTable::GetDistanceAt(uint32_t from, uint32_t to)
+{
+    return dist[(size_t)from*Size() + to];
+}
+uint32_t DistanceTable::GetNextHopAt(uint32_t from, uint32_t to)
+{
+    // A slot past the neighbors of from can only come from a damaged file.
+    uint16_t slot = hops[(size_t)from*Size() + to];
+    if (slot == TABLE_NO_HOP || offsets[from] + slot >= offsets[from+1])
+        return GRAPH_NONE;
+    return neighbors[offsets[from] + slot];
+}
+
+bool DistanceTable::Save(fs::path path)
+{
+    FileWriter out(path, true);
+    if (!out.IsOpen())
+        return false;
+
+    size_t n = Size();
+    DistanceTableHeader header = { DISTANCE_TABLE_MAGIC, DISTANCE_TABLE_VERSION, (uint32_t)n, (uint32_t)neighbors.size() };
+    out.Write((const char *)&header, sizeof(header));
+    out.Write((const char *)ids.data(), ids.size() * sizeof(JunctionID));
+    out.Write((const char *)offsets.data(), offsets.size() * sizeof(uint32_t));
+    out.Write((const char *)neighbors.data(), neighbors.size() * sizeof(uint32_t));
+    out.Write((const char *)lengths.data(), lengths.size() * sizeof(uint32_t));
+    out.Write((const char *)dist, n*n * sizeof(uint32_t));
+    out.Write((const char *)hops, n*n * sizeof(uint16_t));
+    return out.Close();
+}
+bool DistanceTable::Load(fs::path path)
+{
+    // The graph is small and copied, the rows stay in the mapping.
+    if (!file.Open(path) || file.size < sizeof(DistanceTableHeader))
+        return false;
+    DistanceTableHeader h;
+    memcpy(&h, file.data, sizeof(h));
+    uint64_t n = h.count;
+    uint64_t expected = sizeof(h) + (n + n+1 + 2*(uint64_t)h.edgeCount + n*n) * sizeof(uint32_t) + n*n * sizeof(uint16_t);
+    if (h.magic != DISTANCE_TABLE_MAGIC || h.version != DISTANCE_TABLE_VERSION || expected != file.size) {
+        printf("Not a valid version %d distance table\n", DISTANCE_TABLE_VERSION);
+        file.Close();
+        return false;
+    }
+
+    const uint32_t *p = (const uint32_t *)(file.data + sizeof(h));
+    ids.assign(p, p + n);
+    p += n;
+    offsets.assign(p, p + n+1);
+    p += n+1;
+    neighbors.assign(p, p + h.edgeCount);
+    p += h.edgeCount;
+    lengths.assign(p, p + h.edgeCount);
+    p += h.edgeCount;
+
+    // The size fits, the graph has to make sense too, or lookups in it
+    // would read out of bounds.
+    bool valid = offsets[0] == 0 && offsets[n] == h.edgeCount;
+    for (uint64_t i = 0; i < n && valid; i++)
+        valid = offsets[i] <= offsets[i+1];
+    for (uint64_t k = 0; k < h.edgeCount && valid; k++)
+        valid = neighbors[k] < n;
+    if (!valid) {
+        printf("Distance table %s has a broken graph\n", path.string().c_str());
+        ids.clear();
+        offsets.clear();
+        neighbors.clear();
+        lengths.clear();
+        file.Close();
+        return false;
+    }
+    dist = p;
+    hops = (const uint16_t *)(p + n*n);
+
+    indices.clear();
+    indices.reserve(n);
+    for (uint32_t i = 0; i < n; i++)
+        indices[ids[i]] = i;
+    ownedDist.clear();
+    ownedHops.clear();
+    return true;
+}
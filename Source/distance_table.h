@@ -0,0 +1,72 @@
+#ifndef DISTANCE_TABLE_H
+#define DISTANCE_TABLE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <filesystem>
+#include "maze_graph.h"
+#include "mapped_file.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+#define TABLE_NO_HOP UINT16_MAX
+
+// Table files (.mzd) hold the header, then ids, offsets, neighbors and
+// lengths of the graph in MazeGraph layout, then the distance rows and
+// finally the next hop rows. Next hops are stored as the slot in the
+// neighbor list of the source, which keeps them at two bytes.
+#define DISTANCE_TABLE_MAGIC 0x44545a4d // "MZTD"
+#define DISTANCE_TABLE_VERSION 1
+
+struct DistanceTableHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t edgeCount;
+};
+
+// All pairs distance and next hop table of a maze graph. It is built with
+// one Dijkstra per source spread over all cores, and afterwards answers
+// distance and next hop queries with a single array lookup.
+class DistanceTable {
+private:
+    MappedFile file;
+    vector<uint32_t> ownedDist;
+    vector<uint16_t> ownedHops;
+    const uint32_t *dist = nullptr;
+    const uint16_t *hops = nullptr;
+
+    void CopyGraph(MazeGraph &graph);
+    void BuildRows(MazeGraph &graph, vector<uint32_t> &sources, int threads);
+    void Detach();
+
+public:
+    // The graph the table was built from.
+    vector<JunctionID> ids;
+    vector<uint32_t> offsets;
+    vector<uint32_t> neighbors;
+    vector<uint32_t> lengths;
+    unordered_map<JunctionID, uint32_t> indices;
+
+    DistanceTable();
+
+    // Threads defaults to the number of cores.
+    bool Build(MazeGraph &graph, int threads=0);
+    // Brings the table up to date with an edited graph. Only the sources
+    // whose rows could have changed are searched again, unless junctions
+    // were added or removed. Returns the number of rebuilt sources.
+    int Update(MazeGraph &graph, int threads=0);
+
+    uint32_t Size();
+    uint32_t GetDistance(JunctionID from, JunctionID to);
+    JunctionID GetNextHop(JunctionID from, JunctionID to);
+    uint32_t GetDistanceAt(uint32_t from, uint32_t to);
+    uint32_t GetNextHopAt(uint32_t from, uint32_t to);
+
+    bool Save(fs::path path);
+    bool Load(fs::path path);
+};
+
+#endif
@@ -91,6 +91,10 @@ public:
                      Gui::TableSetBgColor(ImGuiTableBgTarget_CellBg, Gui::GetColorU32(ImVec4(0.1, 0.3, 0.1, 1)));
                      type = "JSON";
                 }
+                if (path.extension() == ".mzb") {
+                     Gui::TableSetBgColor(ImGuiTableBgTarget_CellBg, Gui::GetColorU32(ImVec4(0.3, 0.2, 0.1, 1)));
+                     type = "MZB";
+                }
                 Gui::Text("%s", type.c_str());
                 
                 Gui::TableSetColumnIndex(1);
@@ -0,0 +1,129 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+using namespace std;
+namespace fs = filesystem;
+
+// Buffered writer the exporters stream through. Output is collected in a
+// fixed chunk which is handed to the file whenever it fills up.
+// With atomic set everything goes to a temporary file next to the target,
+// which is only renamed over it when Close() succeeds. A failed save then
+// never leaves a half written file behind.
+class FileWriter {
+private:
+    FILE *file = nullptr;
+    fs::path targetPath;
+    fs::path writePath;
+    vector<char> chunk;
+    size_t used = 0;
+    bool failed = false;
+
+public:
+    FileWriter(fs::path path, bool atomic, size_t chunkSize = 1 << 20)
+    : targetPath(path), writePath(path), chunk(chunkSize)
+    {
+        if (atomic)
+            writePath += ".tmp";
+        file = fopen(writePath.string().c_str(), "wb");
+    }
+    ~FileWriter()
+    {
+        if (file != nullptr) {
+            fclose(file);
+            error_code ec;
+            fs::remove(writePath, ec);
+        }
+    }
+    bool IsOpen()
+    {
+        return file != nullptr;
+    }
+    void Flush()
+    {
+        if (used > 0 && fwrite(chunk.data(), 1, used, file) != used)
+            failed = true;
+        used = 0;
+    }
+    void Write(const char *data, size_t n)
+    {
+        if (used + n > chunk.size()) {
+            Flush();
+            if (n > chunk.size()) {
+                failed |= fwrite(data, 1, n, file) != n;
+                return;
+            }
+        }
+        memcpy(chunk.data()+used, data, n);
+        used += n;
+    }
+    void Write(const char *s)
+    {
+        Write(s, strlen(s));
+    }
+    void WriteInt(int64_t v)
+    {
+        char buf[24];
+        char *end = to_chars(buf, buf + sizeof(buf), v).ptr;
+        Write(buf, end-buf);
+    }
+    void WriteString(const string &s)
+    {
+        // Writes s quoted, escaping what JSON does not allow raw.
+        Write("\"", 1);
+        size_t start = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            Write(s.data()+start, i-start);
+            start = i+1;
+            switch (c) {
+                case '"':  Write("\\\""); break;
+                case '\\': Write("\\\\"); break;
+                case '\n': Write("\\n"); break;
+                case '\r': Write("\\r"); break;
+                case '\t': Write("\\t"); break;
+                default: {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    Write(buf);
+                }
+            }
+        }
+        Write(s.data()+start, s.size()-start);
+        Write("\"", 1);
+    }
+    void WriteAt(long offset, const void *data, size_t n)
+    {
+        // Overwrites earlier output, used to fill in headers at the end.
+        Flush();
+        failed |= fseek(file, offset, SEEK_SET) != 0;
+        failed |= fwrite(data, 1, n, file) != n;
+        failed |= fseek(file, 0, SEEK_END) != 0;
+    }
+    bool Close()
+    {
+        Flush();
+        failed |= ferror(file) != 0;
+        failed |= fclose(file) != 0;
+        file = nullptr;
+
+        error_code ec;
+        if (!failed && writePath != targetPath)
+            fs::rename(writePath, targetPath, ec);
+        if (failed || ec) {
+            fs::remove(writePath, ec);
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include "generation_task.h"
+
+// Tiles are the unit of work, small ones keep a single step short.
+#define TASK_TILE_SIZE 32
+
+bool GenerationTask::Start(Maze &maze, MazeGeneratorSettings settings)
+{
+    settings.idBase = 0;
+    settings.tileSize = TASK_TILE_SIZE;
+    generator = MazeGenerator(settings);
+    if (!generator.Prepare(maze)) {
+        Cancel();
+        return false;
+    }
+    MazeGeneratorSettings &s = generator.GetSettings();
+    committed.assign((size_t)s.width*s.height, 0);
+    maze.Reserve(committed.size());
+    nextTile = 0;
+    stitched = false;
+    paused = false;
+    added = 0;
+    skipped = 0;
+    return true;
+}
+
+void GenerationTask::Cancel()
+{
+    nextTile = generator.TileCount();
+    stitched = true;
+    vector<char>().swap(committed);
+}
+
+bool GenerationTask::IsRunning()
+{
+    return !stitched;
+}
+
+float GenerationTask::GetProgress()
+{
+    if (!IsRunning())
+        return 1.0f;
+    return (float)nextTile / (generator.TileCount() + 1);
+}
+
+bool GenerationTask::IsFree(Maze &maze, Coord c)
+{
+    return maze.GetJunctionAt(c.x, c.y) == 0 && maze.GetTunnelAt(c.x, c.y).from == 0;
+}
+
+void GenerationTask::Commit(Maze &maze, vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels)
+{
+    MazeGeneratorSettings &s = generator.GetSettings();
+    vector<JunctionRecord> keptJunctions;
+    vector<Tunnel> keptTunnels;
+    keptJunctions.reserve(junctions.size());
+    keptTunnels.reserve(tunnels.size());
+
+    for (JunctionRecord &r: junctions) {
+        if (!IsFree(maze, r.coord) || maze.JunctionExists(r.id)) {
+            skipped++;
+            continue;
+        }
+        committed[r.id - s.idBase] = 1;
+        keptJunctions.push_back(move(r));
+    }
+
+    // Both ends must be ours and the cells in between free.
+    for (Tunnel t: tunnels) {
+        if (!committed[t.from - s.idBase] || !committed[t.to - s.idBase])
+            continue;
+        // The ends give the direction, with a width of 1 the junction
+        // below is also the next ID.
+        uint32_t a = min(t.from, t.to) - s.idBase, b = max(t.from, t.to) - s.idBase;
+        Coord from = s.origin + Coord((a % s.width)*s.spacing, (a / s.width)*s.spacing);
+        Coord step = b - a == (uint32_t)s.width ? Coord(0, 1) : Coord(1, 0);
+        bool free = true;
+        for (int k = 1; k < s.spacing && free; k++)
+            free = IsFree(maze, from + Coord(step.x*k, step.y*k));
+        if (free)
+            keptTunnels.push_back(t);
+    }
+
+    vector<TagCoord> tags;
+    added += keptJunctions.size();
+    maze.BulkInsert(keptJunctions, keptTunnels, tags);
+}
+
+bool GenerationTask::Step(Maze &maze, double budget)
+{
+    if (!IsRunning() || paused)
+        return IsRunning();
+
+    auto start = chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    vector<JunctionRecord> junctions;
+    vector<Tunnel> tunnels;
+
+    // Stitches go last, they need the junctions of every tile.
+    int tileCount = generator.TileCount();
+    if (nextTile == tileCount) {
+        generator.GenerateStitches(tunnels);
+        Commit(maze, junctions, tunnels);
+        stitched = true;
+        vector<char>().swap(committed);
+        printf("Generated %zu junctions, skipped %zu taken cells\n", added, skipped);
+        return false;
+    }
+
+    // At least one tile per step, then more while another tile and the
+    // commit of everything still fit in the budget. The first step has no
+    // measured commit cost yet and sticks to one tile.
+    int done = 0;
+    size_t tileJunctions = TASK_TILE_SIZE*TASK_TILE_SIZE;
+    do {
+        generator.GenerateTile(nextTile++, junctions, tunnels);
+        done++;
+    } while (nextTile < tileCount && commitCost > 0 && elapsed()*(done+1)/done + (junctions.size() + tileJunctions)*commitCost < budget);
+
+    double before = elapsed();
+    Commit(maze, junctions, tunnels);
+    double cost = (elapsed() - before) / max((size_t)1, junctions.size());
+    commitCost = commitCost == 0 ? cost : 0.8*commitCost + 0.2*cost;
+    return true;
+}
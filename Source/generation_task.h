@@ -0,0 +1,42 @@
+#ifndef GENERATION_TASK_H
+#define GENERATION_TASK_H
+
+#include <cstdint>
+#include <vector>
+#include "maze.h"
+#include "maze_generator.h"
+
+using namespace std;
+
+// Maze generation spread over many frames. Every Step() carves tiles
+// until the time budget is used up and then commits them to the maze in
+// one bulk insert, so the maze is only touched once per step. Cells that
+// are already taken in the maze are skipped along with their tunnels.
+class GenerationTask {
+private:
+    MazeGenerator generator;
+    int nextTile = 0;
+    bool stitched = true;
+    // Junctions of the generated grid that made it into the maze.
+    vector<char> committed;
+    // Measured cost of committing one junction, to plan the next step.
+    double commitCost = 0;
+
+    bool IsFree(Maze &maze, Coord c);
+    void Commit(Maze &maze, vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels);
+
+public:
+    bool paused = false;
+    size_t added = 0;
+    size_t skipped = 0;
+
+    bool Start(Maze &maze, MazeGeneratorSettings settings);
+    // Advances within budget seconds, returns false once finished.
+    bool Step(Maze &maze, double budget);
+    void Cancel();
+
+    bool IsRunning();
+    float GetProgress();
+};
+
+#endif
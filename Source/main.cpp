@@ -21,7 +21,7 @@ int main() {
 
     while (!WindowShouldClose()) {
         editor.Update();
-        DragCameraUpdate(0.1, 10, 0.5, 20, 400);
+        DragCameraUpdate(0.005, 10, 0.5, 20, 400);
 
         BeginDrawing();
         rlImGuiBegin();
@@ -0,0 +1,58 @@
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+MappedFile::MappedFile()
+{
+}
+MappedFile::~MappedFile()
+{
+    Close();
+}
+bool MappedFile::Open(fs::path path)
+{
+    Close();
+#ifdef _WIN32
+    ifstream stream(path, ios::binary);
+    if (!stream.good())
+        return false;
+    fallback.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+    data = fallback.data();
+    size = fallback.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED)
+        return false;
+    madvise(m, st.st_size, MADV_WILLNEED);
+    mapping = m;
+    data = (const char *)m;
+    size = st.st_size;
+#endif
+    return true;
+}
+void MappedFile::Close()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+        munmap(mapping, size);
+#endif
+    mapping = nullptr;
+    fallback.clear();
+    data = nullptr;
+    size = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <vector>
+#include <filesystem>
+
+using namespace std;
+namespace fs = filesystem;
+
+// Read-only memory mapping of a whole file. Platforms without mmap read
+// the file into memory instead.
+class MappedFile {
+private:
+    void *mapping = nullptr;
+    vector<char> fallback;
+
+public:
+    const char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    bool Open(fs::path path);
+    void Close();
+};
+
+#endif
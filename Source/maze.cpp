@@ -1,12 +1,15 @@
+#include <algorithm>
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
 #include <fstream>
 #include <nlohmann/json.hpp>
 using namespace nlohmann;
 
 #include "maze.h"
+#include "file_writer.h"
 namespace fs = filesystem;
 
-#include "arclib.h"
-
 //
 // Coord methods.
 //
@@ -21,7 +24,8 @@ Coord::Coord(int _x, int _y)
 }
 Coord::Coord(CoordID key)
 {
-    sscanf(key.c_str(), "%i,%i", &x, &y);
+    x = (int32_t)((uint32_t)(key >> 32) ^ 0x80000000u);
+    y = (int32_t)((uint32_t)key ^ 0x80000000u);
 }
 Coord Coord::operator+(const Coord &other)
 {
@@ -40,8 +44,10 @@ bool Coord::operator==(const Coord &other)
 CoordID Coord::ToKey()
 {
     // Makes a key for indexing the position->data maps.
-    CoordID key = to_string(x) + string(",") + to_string(y);
-    return key;
+    // Both halves are offset by 2^31 so the keys sort like (x, y).
+    CoordID hi = (uint32_t)x ^ 0x80000000u;
+    CoordID lo = (uint32_t)y ^ 0x80000000u;
+    return hi << 32 | lo;
 }
 
 //
@@ -50,7 +56,7 @@ CoordID Coord::ToKey()
 Junction::Junction()
 {
 }
-Junction::Junction(string _name, JunctionID _id) 
+Junction::Junction(StringHandle _name, JunctionID _id) 
 {
     name = _name;
     id = _id;
@@ -70,6 +76,165 @@ bool JunctionRect::ContainsPoint(int x, int y)
 {
     return top.x <= x && x < bot.x && top.y <= y && y < bot.y;
 }
+bool JunctionRect::operator==(const JunctionRect &other)
+{
+    return top.x == other.top.x && top.y == other.top.y && bot.x == other.bot.x && bot.y == other.bot.y;
+}
+
+//
+// TunnelIndex methods.
+//
+void TunnelIndex::Insert(Tunnel t, Coord a, Coord b)
+{
+    bool horizontal = a.y == b.y;
+    Line &line = horizontal ? rows[a.y] : cols[a.x];
+    Span span;
+    span.lo = horizontal ? min(a.x, b.x) : min(a.y, b.y);
+    span.hi = horizontal ? max(a.x, b.x) : max(a.y, b.y);
+    span.tunnel = t;
+    line.spans.insert({ span.lo, span });
+    line.maxLength = max(line.maxLength, span.hi - span.lo);
+    Stamp(a, b);
+}
+void TunnelIndex::Erase(Tunnel t, Coord a, Coord b)
+{
+    bool horizontal = a.y == b.y;
+    map<int, Line> &lines = horizontal ? rows : cols;
+    auto lineIt = lines.find(horizontal ? a.y : a.x);
+    if (lineIt == lines.end())
+        return;
+
+    multimap<int, Span> &spans = lineIt->second.spans;
+    auto range = spans.equal_range(horizontal ? min(a.x, b.x) : min(a.y, b.y));
+    for (auto it = range.first; it != range.second; it++) {
+        Tunnel other = it->second.tunnel;
+        if ((other.from == t.from && other.to == t.to) || (other.from == t.to && other.to == t.from)) {
+            spans.erase(it);
+            Stamp(a, b);
+            break;
+        }
+    }
+    if (spans.empty())
+        lines.erase(lineIt);
+}
+bool TunnelIndex::FindInterior(map<int, Line> &lines, int line, int pos, Span &out)
+{
+    // Finds a span in the line that strictly contains pos.
+    auto lineIt = lines.find(line);
+    if (lineIt == lines.end())
+        return false;
+
+    // No span is longer than maxLength, so earlier ones can never reach pos.
+    Line &l = lineIt->second;
+    auto end = l.spans.lower_bound(pos);
+    for (auto it = l.spans.lower_bound(pos - l.maxLength); it != end; it++) {
+        Span &s = it->second;
+        if (pos < s.hi) {
+            out = s;
+            return true;
+        }
+    }
+    return false;
+}
+Tunnel TunnelIndex::Find(int x, int y)
+{
+    // Only the interior of a tunnel counts, the endpoints are junctions.
+    Span s;
+    if (FindInterior(rows, y, x, s) || FindInterior(cols, x, y, s))
+        return s.tunnel;
+    return { 0, 0 };
+}
+bool TunnelIndex::Overlaps(Coord a, Coord b)
+{
+    // Checks if segment a-b touches any indexed segment, skipping segments
+    // that share an endpoint with it since tunnels meet at junctions.
+    bool horizontal = a.y == b.y;
+    int line = horizontal ? a.y : a.x;
+    int lo = horizontal ? min(a.x, b.x) : min(a.y, b.y);
+    int hi = horizontal ? max(a.x, b.x) : max(a.y, b.y);
+    map<int, Line> &same = horizontal ? rows : cols;
+    map<int, Line> &cross = horizontal ? cols : rows;
+
+    auto sharesEnd = [&](Span &s, int sLine, bool sHorizontal) {
+        Coord s1 = sHorizontal ? Coord(s.lo, sLine) : Coord(sLine, s.lo);
+        Coord s2 = sHorizontal ? Coord(s.hi, sLine) : Coord(sLine, s.hi);
+        return s1 == a || s1 == b || s2 == a || s2 == b;
+    };
+
+    // Colinear segments on the same line.
+    auto lineIt = same.find(line);
+    if (lineIt != same.end()) {
+        Line &l = lineIt->second;
+        auto end = l.spans.upper_bound(hi);
+        for (auto it = l.spans.lower_bound(lo - l.maxLength); it != end; it++) {
+            Span &s = it->second;
+            if (s.lo <= hi && lo <= s.hi && !sharesEnd(s, line, horizontal))
+                return true;
+        }
+    }
+
+    // Perpendicular segments crossing the line.
+    auto crossEnd = cross.upper_bound(hi);
+    for (auto crossIt = cross.lower_bound(lo); crossIt != crossEnd; crossIt++) {
+        Line &l = crossIt->second;
+        auto end = l.spans.upper_bound(line);
+        for (auto it = l.spans.lower_bound(line - l.maxLength); it != end; it++) {
+            Span &s = it->second;
+            if (s.lo <= line && line <= s.hi && !sharesEnd(s, crossIt->first, !horizontal))
+                return true;
+        }
+    }
+    return false;
+}
+void TunnelIndex::QueryLines(map<int, Line> &lines, int first, int last, int lo, int hi, vector<Tunnel> &tunnels)
+{
+    // Segments on the lines first to last that reach into lo to hi.
+    auto lineEnd = lines.upper_bound(last);
+    for (auto lineIt = lines.lower_bound(first); lineIt != lineEnd; lineIt++) {
+        Line &l = lineIt->second;
+        auto end = l.spans.upper_bound(hi);
+        for (auto it = l.spans.lower_bound(lo - l.maxLength); it != end; it++) {
+            if (it->second.hi >= lo)
+                tunnels.push_back(it->second.tunnel);
+        }
+    }
+}
+void TunnelIndex::Stamp(Coord a, Coord b)
+{
+    // Marks every block the segment passes as changed.
+    revision++;
+    int x0 = min(a.x, b.x) >> GRID_CHUNK_BITS, x1 = max(a.x, b.x) >> GRID_CHUNK_BITS;
+    int y0 = min(a.y, b.y) >> GRID_CHUNK_BITS, y1 = max(a.y, b.y) >> GRID_CHUNK_BITS;
+    for (int x = x0; x <= x1; x++) {
+        for (int y = y0; y <= y1; y++)
+            blockRevisions[Coord(x, y).ToKey()] = revision;
+    }
+}
+void TunnelIndex::Clear()
+{
+    // Keeps counting, like CellGrid::Clear().
+    rows.clear();
+    cols.clear();
+    blockRevisions.clear();
+}
+void TunnelIndex::ContinueFrom(TunnelIndex &other)
+{
+    // For an empty index that replaces other, views of other then see
+    // every block as changed.
+    revision = other.revision;
+}
+uint64_t TunnelIndex::GetRevision(int bx, int by)
+{
+    auto it = blockRevisions.find(Coord(bx, by).ToKey());
+    return it != blockRevisions.end() ? it->second : 0;
+}
+void TunnelIndex::Query(Coord lo, Coord hi, vector<Tunnel> &tunnels)
+{
+    // Appends the segments touching the area, horizontal ones from the
+    // rows and vertical ones from the columns.
+    QueryLines(rows, lo.y, hi.y, lo.x, hi.x, tunnels);
+    QueryLines(cols, lo.x, hi.x, lo.y, hi.y, tunnels);
+}
 
 //
 // TagCoord methods
@@ -84,29 +249,336 @@ TagCoord::TagCoord(vector<string> &_tags, Coord _coord)
 
 }
 
+//
+// CellGrid methods.
+//
+// Many small batches would otherwise rehash the whole map on every call.
+template <typename T>
+static void ReserveMore(T &map, size_t extra)
+{
+    size_t needed = map.size() + extra;
+    if (needed > map.bucket_count() * map.max_load_factor())
+        map.reserve(max(needed, 2*map.size()));
+}
+GridBackend CellGrid::GetBackend()
+{
+    return backend;
+}
+void CellGrid::SetBackend(GridBackend _backend)
+{
+    if (backend == _backend)
+        return;
+    vector<pair<Coord, uint32_t>> set;
+    set.reserve(Size());
+    ForEach([&](Coord c, uint32_t value) { set.push_back({ c, value }); });
+    Clear();
+    backend = _backend;
+    Reserve(set.size());
+    for (auto &pair: set)
+        Set(pair.first.x, pair.first.y, pair.second);
+}
+uint32_t CellGrid::Get(int x, int y)
+{
+    if (backend == GRID_HASH) {
+        auto it = cells.find(Coord(x, y).ToKey());
+        return it != cells.end() ? it->second : 0;
+    }
+    // Unsigned compares also reject chunks left of or above the directory.
+    unsigned cx = (x >> GRID_CHUNK_BITS) - chunkX;
+    unsigned cy = (y >> GRID_CHUNK_BITS) - chunkY;
+    if (cx >= (unsigned)chunkW || cy >= (unsigned)chunkH)
+        return 0;
+    vector<uint32_t> &chunk = chunks[cy*chunkW + cx];
+    if (chunk.empty())
+        return 0;
+    return chunk[(y & (GRID_CHUNK_SIZE-1)) << GRID_CHUNK_BITS | (x & (GRID_CHUNK_SIZE-1))];
+}
+void CellGrid::Set(int x, int y, uint32_t value)
+{
+    blockRevisions[Coord(x >> GRID_CHUNK_BITS, y >> GRID_CHUNK_BITS).ToKey()] = ++revision;
+    if (backend == GRID_HASH) {
+        CoordID key = Coord(x, y).ToKey();
+        if (value != 0)
+            cells[key] = value;
+        else
+            cells.erase(key);
+        return;
+    }
+
+    int cx = x >> GRID_CHUNK_BITS;
+    int cy = y >> GRID_CHUNK_BITS;
+    if (cx < chunkX || cx >= chunkX+chunkW || cy < chunkY || cy >= chunkY+chunkH) {
+        if (value == 0)
+            return;
+        if (!GrowDirectory(cx, cy)) {
+            SetBackend(GRID_HASH);
+            Set(x, y, value);
+            return;
+        }
+    }
+    size_t i = (size_t)(cy-chunkY)*chunkW + (cx-chunkX);
+    vector<uint32_t> &chunk = chunks[i];
+    if (chunk.empty()) {
+        if (value == 0)
+            return;
+        chunk.resize(GRID_CHUNK_CELLS, 0);
+    }
+    uint32_t &cell = chunk[(y & (GRID_CHUNK_SIZE-1)) << GRID_CHUNK_BITS | (x & (GRID_CHUNK_SIZE-1))];
+    if (cell == 0 && value != 0) {
+        count++;
+        chunkCounts[i]++;
+    } else if (cell != 0 && value == 0) {
+        count--;
+        if (--chunkCounts[i] == 0) {
+            // Give the memory of an emptied chunk back.
+            vector<uint32_t>().swap(chunk);
+            return;
+        }
+    }
+    cell = value;
+}
+bool CellGrid::GrowDirectory(int cx, int cy)
+{
+    // Extends the directory over chunk (cx, cy), and by half again on the
+    // growing sides so a maze growing chunk by chunk rarely moves it.
+    int x0 = cx, x1 = cx+1, y0 = cy, y1 = cy+1;
+    if (chunkW > 0) {
+        x0 = cx < chunkX ? min(cx, chunkX - chunkW/2) : chunkX;
+        x1 = cx >= chunkX+chunkW ? max(cx+1, chunkX+chunkW + chunkW/2) : chunkX+chunkW;
+        y0 = cy < chunkY ? min(cy, chunkY - chunkH/2) : chunkY;
+        y1 = cy >= chunkY+chunkH ? max(cy+1, chunkY+chunkH + chunkH/2) : chunkY+chunkH;
+    }
+    if ((int64_t)(x1-x0) * (y1-y0) > GRID_MAX_CHUNKS)
+        return false;
+
+    vector<vector<uint32_t>> grown((size_t)(x1-x0) * (y1-y0));
+    vector<uint32_t> grownCounts(grown.size(), 0);
+    for (int y = 0; y < chunkH; y++) {
+        for (int x = 0; x < chunkW; x++) {
+            size_t from = (size_t)y*chunkW + x;
+            size_t to = (size_t)(chunkY+y-y0)*(x1-x0) + (chunkX+x-x0);
+            grown[to].swap(chunks[from]);
+            grownCounts[to] = chunkCounts[from];
+        }
+    }
+    chunks.swap(grown);
+    chunkCounts.swap(grownCounts);
+    chunkX = x0;
+    chunkY = y0;
+    chunkW = x1-x0;
+    chunkH = y1-y0;
+    return true;
+}
+void CellGrid::Clear()
+{
+    unordered_map<CoordID, uint32_t, CoordHash>().swap(cells);
+    vector<vector<uint32_t>>().swap(chunks);
+    vector<uint32_t>().swap(chunkCounts);
+    chunkX = chunkY = chunkW = chunkH = 0;
+    count = 0;
+    // Every block is back to revision 0, which no block with cells has.
+    unordered_map<CoordID, uint64_t, CoordHash>().swap(blockRevisions);
+}
+void CellGrid::ContinueFrom(CellGrid &other)
+{
+    // For an empty grid that replaces other. It takes the backend and
+    // counts on from its revision, so views of other see every block as
+    // changed.
+    backend = other.backend;
+    revision = other.revision;
+}
+void CellGrid::Reserve(size_t extra)
+{
+    // Chunks come in as cells are set, only the hash backend can prepare.
+    if (backend == GRID_HASH)
+        ReserveMore(cells, extra);
+}
+size_t CellGrid::Size()
+{
+    return backend == GRID_HASH ? cells.size() : count;
+}
+uint64_t CellGrid::GetRevision(int bx, int by)
+{
+    auto it = blockRevisions.find(Coord(bx, by).ToKey());
+    return it != blockRevisions.end() ? it->second : 0;
+}
+
 //
 // Maze methods.
 //
 Maze::Maze()
 {
     name = "Unnamed Maze";
+    tag_lists.resize(1);
+    junction_reach = { { 0, 0 }, { 1, 1 } };
+    junction_lo = { INT_MAX, INT_MAX };
+    junction_hi = { INT_MIN, INT_MIN };
 }
 void Maze::Erase()
 {
-    *this = Maze();
+    Maze empty;
+    empty.ContinueFrom(*this);
+    Adopt(empty);
+}
+void Maze::ContinueFrom(Maze &other)
+{
+    // For an empty maze that is to replace other. The grids keep the
+    // backends of other and count on from its revisions, so views of
+    // other see every block as changed.
+    verbose = other.verbose;
+    coord_to_id.ContinueFrom(other.coord_to_id);
+    coord_to_tags.ContinueFrom(other.coord_to_tags);
+    tunnel_index.ContinueFrom(other.tunnel_index);
+}
+void Maze::Adopt(Maze &other)
+{
+    // Takes over the contents of other, made with ContinueFrom(*this).
+    // Keep counting versions and the journal, a replaced maze is still an
+    // edit.
+    uint64_t v = version;
+    bool wasVerbose = verbose;
+    vector<MazeChange> oldJournal = move(journal);
+    uint64_t oldStart = journal_start;
+    vector<pair<int, ChangeCallback>> oldSubscribers = move(subscribers);
+    int oldNext = next_subscriber;
+    *this = move(other);
+    version = v;
+    verbose = wasVerbose;
+    journal = move(oldJournal);
+    journal_start = oldStart;
+    subscribers = move(oldSubscribers);
+    next_subscriber = oldNext;
+    Record(CHANGE_ERASE, 0, 0, Coord(0, 0), Coord(0, 0));
+}
+bool Maze::Load(string mazeName, vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels,
+    vector<TagCoord> &tags, bool validate)
+{
+    // Replaces the maze with the records of a file. A checked maze is
+    // built aside first, on conflicts this maze stays as it was.
+    if (!validate) {
+        Erase();
+        name = mazeName;
+        BulkInsert(junctions, tunnels, tags);
+        return true;
+    }
+    Maze loaded;
+    loaded.ContinueFrom(*this);
+    loaded.name = mazeName;
+    loaded.BulkInsert(junctions, tunnels, tags);
+    if (loaded.Validate(true).size() > 0)
+        return false;
+    Adopt(loaded);
+    return true;
+}
+void Maze::Log(const char *format, ...)
+{
+    if (!verbose)
+        return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+//
+// Change methods.
+//
+void Maze::Record(ChangeKind kind, JunctionID id, JunctionID other, Coord lo, Coord hi)
+{
+    version++;
+    MazeChange change = { version, kind, id, other, lo, hi };
+    if (journal.empty())
+        journal.resize(MAZE_JOURNAL_SIZE);
+    journal[(version-1) % MAZE_JOURNAL_SIZE] = change;
+    if (version - journal_start > MAZE_JOURNAL_SIZE)
+        journal_start = version - MAZE_JOURNAL_SIZE;
+    for (auto &subscriber: subscribers)
+        subscriber.second(change);
+}
+bool Maze::GetChanges(uint64_t since, vector<MazeChange> &changes)
+{
+    // Replaces the list with the changes after version since, oldest
+    // first. False when the journal no longer reaches back that far, the
+    // caller has to take everything as changed.
+    changes.clear();
+    if (since < journal_start || since > version)
+        return false;
+    for (uint64_t v = since+1; v <= version; v++)
+        changes.push_back(journal[(v-1) % MAZE_JOURNAL_SIZE]);
+    return true;
+}
+int Maze::Subscribe(ChangeCallback callback)
+{
+    // The callback sees every change right after it was made, until
+    // unsubscribed. Erasing the maze keeps the subscribers.
+    int subscriber = next_subscriber++;
+    subscribers.push_back({ subscriber, callback });
+    return subscriber;
+}
+void Maze::Unsubscribe(int subscriber)
+{
+    for (auto it = subscribers.begin(); it != subscribers.end(); it++) {
+        if (it->first == subscriber) {
+            subscribers.erase(it);
+            return;
+        }
+    }
+}
+
+//
+// Grid methods.
+//
+GridBackend Maze::GetGridBackend()
+{
+    return coord_to_id.GetBackend();
+}
+void Maze::SetGridBackend(GridBackend backend)
+{
+    // Moves the cells over, the maze itself does not change.
+    coord_to_id.SetBackend(backend);
+    coord_to_tags.SetBackend(backend);
+}
+
+//
+// Sorted vector helpers, for the tag index.
+//
+static void InsertSorted(vector<CoordID> &list, CoordID key)
+{
+    auto it = lower_bound(list.begin(), list.end(), key);
+    if (it == list.end() || *it != key)
+        list.insert(it, key);
+}
+static bool GallopTo(const vector<CoordID> &list, size_t &pos, CoordID key)
+{
+    // Exponential search forward from pos, which is left at the first
+    // entry not below key. Cheap when the keys come in increasing order.
+    size_t lo = pos, hi = pos, step = 1;
+    while (hi < list.size() && list[hi] < key) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    hi = min(hi, list.size());
+    pos = lower_bound(list.begin() + lo, list.begin() + hi, key) - list.begin();
+    return pos < list.size() && list[pos] == key;
+}
+static void EraseSorted(vector<CoordID> &list, CoordID key)
+{
+    auto it = lower_bound(list.begin(), list.end(), key);
+    if (it != list.end() && *it == key)
+        list.erase(it);
 }
 
 //
 // Junction methods.
 //
-void Maze::AddJunction(int x, int y, string name, JunctionID id) 
+void Maze::AddJunction(int x, int y, string name, JunctionID id, bool split) 
 {
     if (GetJunctionAt(x, y) != 0) {
-        printf("Junction at %i %i already exists", x, y);
+        Log("Junction at %i %i already exists", x, y);
         return;
     }
     Coord coord = Coord(x, y);
-    CoordID key = coord.ToKey();
 
     // Ensure uniqueness.
     if (id == 0) {
@@ -114,38 +586,59 @@ void Maze::AddJunction(int x, int y, string name, JunctionID id)
         while (id != 0 && JunctionExists(id))
             id = rand();
     }
-    Junction j = Junction(name, id);
-    printf("Added junction %s (%i) at key %s (%d, %d)\n", name.c_str(), j.id, key.c_str(), x, y);
+    Junction j = Junction(name_pool.Intern(name), id);
+    Log("Added junction %s (%i) at (%d, %d)\n", name.c_str(), j.id, x, y);
 
     id_to_junction[id] = j;
+    name_to_id.emplace(name_pool.Get(j.name), id);
     id_to_rect[id] = { { 0, 0 }, { 1, 1 } };
     id_to_coord[id] = coord;
-    coord_to_id[key] = id;
+    coord_to_id.Set(x, y, id);
+    InsertBucket(id, coord);
+    Record(CHANGE_ADD_JUNCTION, id, 0, coord, coord);
 
     // Split a tunnel if inserting on a tunnel.
     Tunnel tunnel = GetTunnelAt(x, y);
-    if (tunnel.from != 0 && tunnel.to != 0) {
+    if (split && tunnel.from != 0 && tunnel.to != 0) {
         RemoveTunnel(tunnel);
         AddTunnel(tunnel.from, id);
         AddTunnel(tunnel.to, id);
-        printf("Split tunnel at %i, %i", x, y);
+        Log("Split tunnel at %i, %i", x, y);
     }
 }
 void Maze::RemoveJunction(JunctionID id)
 {
+    auto it = id_to_junction.find(id);
+    if (it == id_to_junction.end()) {
+        Log("Junction (%i) does not exist\n", id);
+        return;
+    }
+    Coord coord = id_to_coord[id];
+
     // Remove all tunnels attached.
     for (auto kv: tunnel_map[id]) {
+        Coord other = GetJunctionCoord(kv.first);
         tunnel_map[kv.first].erase(id);
-        printf("Erasing tunnel %i->%i\n", id, kv.first);
+        tunnel_index.Erase({ id, kv.first }, coord, other);
+        Record(CHANGE_REMOVE_TUNNEL, id, kv.first, { min(coord.x, other.x), min(coord.y, other.y) },
+            { max(coord.x, other.x), max(coord.y, other.y) });
+        Log("Erasing tunnel %i->%i\n", id, kv.first);
     }
 
-    Coord coord = id_to_coord[id];
-
+    // Clear every cell of the rectangle, not only the coordinate.
+    JunctionRect rect = id_to_rect[id];
+    for (int x = rect.top.x; x < rect.bot.x; x++) {
+        for (int y = rect.top.y; y < rect.bot.y; y++)
+            coord_to_id.Set(coord.x+x, coord.y+y, 0);
+    }
     tunnel_map.erase(id);
-    id_to_junction.erase(id);
+    name_to_id.erase({ name_pool.Get(it->second.name), id });
+    EraseBucket(id, coord);
+    id_to_junction.erase(it);
+    id_to_rect.erase(id);
     id_to_coord.erase(id);
-    coord_to_id.erase(coord.ToKey());
-    printf("Junction (%i) at %i %i removed\n", id, coord.x, coord.y);
+    Record(CHANGE_REMOVE_JUNCTION, id, 0, coord + rect.top, coord + rect.bot - Coord(1, 1));
+    Log("Junction (%i) at %i %i removed\n", id, coord.x, coord.y);
 }
 bool Maze::JunctionExists(JunctionID id)
 {
@@ -154,32 +647,68 @@ bool Maze::JunctionExists(JunctionID id)
 
 JunctionID Maze::GetJunctionAt(int x, int y)
 {
-    CoordID key = Coord(x, y).ToKey();
-    if (coord_to_id.find(key) != coord_to_id.end()) {
-        return coord_to_id[key];
-    }
-    return 0;
+    return coord_to_id.Get(x, y);
 }
 Junction& Maze::GetJunction(JunctionID id) 
 {
     return id_to_junction[id];
 }
+const string &Maze::GetJunctionName(JunctionID id)
+{
+    auto it = id_to_junction.find(id);
+    return name_pool.Get(it != id_to_junction.end() ? it->second.name : 0);
+}
 Coord Maze::GetJunctionCoord(JunctionID id)
 {
-    if (JunctionExists(id)) {
-        return id_to_coord[id];
+    auto it = id_to_coord.find(id);
+    if (it != id_to_coord.end()) {
+        return it->second;
     }
     return Coord {0, 0};
 }
+bool Maze::RenameJunction(JunctionID id, string name)
+{
+    // Names are indexed, so they change only through here.
+    auto it = id_to_junction.find(id);
+    if (it == id_to_junction.end())
+        return false;
+    StringHandle handle = name_pool.Intern(name);
+    if (it->second.name == handle)
+        return true;
+    name_to_id.erase({ name_pool.Get(it->second.name), id });
+    name_to_id.emplace(name_pool.Get(handle), id);
+    it->second.name = handle;
+    Coord coord = GetJunctionCoord(id);
+    JunctionRect rect = GetJunctionRect(id);
+    Record(CHANGE_RENAME_JUNCTION, id, 0, coord + rect.top, coord + rect.bot - Coord(1, 1));
+    return true;
+}
 JunctionID Maze::FindJunction(string name)
 {
-    vector<JunctionID> junctions = GetJunctionList();
-    for (JunctionID id: junctions) {
-        Junction &j = GetJunction(id);
-        if (j.name == name)
-            return id;
+    // The lowest ID of the junctions with this name.
+    auto it = name_to_id.lower_bound({ name, 0 });
+    return it != name_to_id.end() && it->first == name ? it->second : 0;
+}
+vector<JunctionID> Maze::FindJunctions(string name)
+{
+    vector<JunctionID> junctions;
+    for (auto it = name_to_id.lower_bound({ name, 0 }); it != name_to_id.end() && it->first == name; it++)
+        junctions.push_back(it->second);
+    return junctions;
+}
+vector<JunctionID> Maze::FindJunctionsByPrefix(string prefix, int limit)
+{
+    // Names sharing a prefix are neighbors in the index, so this reads
+    // only the matches. A sector prefix such as "N" lists its junctions.
+    vector<JunctionID> junctions;
+    for (auto it = name_to_id.lower_bound({ prefix, 0 }); it != name_to_id.end(); it++) {
+        if (it->first.compare(0, prefix.size(), prefix) != 0)
+            break;
+        if (limit >= 0 && junctions.size() >= limit)
+            break;
+        junctions.push_back(it->second);
     }
-    return 0;
+    return junctions;
 }
 vector<JunctionID> Maze::GetJunctionList()
 {
@@ -197,31 +726,34 @@ vector<JunctionID> Maze::GetConnectedJunctions(JunctionID source)
     }
     return junctions;
 }
+bool Maze::IsPrunable(JunctionID id, vector<JunctionID> &connected)
+{
+    // Loose junctions and colinear junctions of degree 2 can go, the
+    // latter leave a tunnel between the two connected junctions.
+    connected = GetConnectedJunctions(id);
+    int num = connected.size();
+    if (num == 0)
+        return true;
+    if (num != 2)
+        return false;
+    Coord pos = GetJunctionCoord(id);
+    Coord c1 = GetJunctionCoord(connected[0]);
+    Coord c2 = GetJunctionCoord(connected[1]);
+    return (c1.x == pos.x && c2.x == pos.x) || (c1.y == pos.y && c2.y == pos.y);
+}
 void Maze::PruneJunctions()
 {
     // Prune all colinear junctions.
     vector<JunctionID> junctions = GetJunctionList();
+    vector<JunctionID> connected;
 
     for (JunctionID j: junctions) {
-        Coord pos = GetJunctionCoord(j);
-        vector<JunctionID> connected = GetConnectedJunctions(j);
-        int num = connected.size();
-        
-        // Prune junctions on a tunnel.
-        if (num == 2) {
-            Coord c1 = GetJunctionCoord(connected[0]);
-            Coord c2 = GetJunctionCoord(connected[1]);
-
-            if (c1.x == pos.x && c2.x == pos.x || c1.y == pos.y && c2.y == pos.y) {
-                RemoveJunction(j);
-                AddTunnel(connected[0], connected[1]);
-                printf("Pruned node %d due to colinear degree 2", j);
-            }
-        }
-
-        // Prune loose junctions.
-        if (num == 0) {
-            RemoveJunction(j);
+        if (!IsPrunable(j, connected))
+            continue;
+        RemoveJunction(j);
+        if (connected.size() == 2) {
+            AddTunnel(connected[0], connected[1]);
+            Log("Pruned node %d due to colinear degree 2", j);
         }
     }
 }
@@ -233,10 +765,15 @@ bool Maze::SetJunctionRect(JunctionID id, JunctionRect rect)
 {
     // Validate rectangle.
     if (!(rect.top.x < rect.bot.x && rect.top.y < rect.bot.y)) {
-        printf("Rectangle top must be < bot\n");
+        Log("Rectangle top must be < bot\n");
         return false;
     }
 
+    // Nothing to do, the editor sets the same rectangle every frame.
+    auto it = id_to_rect.find(id);
+    if (it != id_to_rect.end() && it->second == rect)
+        return true;
+
     Coord c = GetJunctionCoord(id);
 
     // Validate if no other junctions exist in rectangle.
@@ -244,7 +781,7 @@ bool Maze::SetJunctionRect(JunctionID id, JunctionRect rect)
         for (int y = rect.top.y; y < rect.bot.y; y++) {
             JunctionID other = GetJunctionAt(c.x+x, c.y+y);
             if (other > 0 && other != id) {
-                printf("Existing junction under rect, abort.\n");
+                Log("Existing junction under rect, abort.\n");
                 return false;
             }
         }
@@ -259,8 +796,8 @@ bool Maze::SetJunctionRect(JunctionID id, JunctionRect rect)
         for (int y = old.top.y; y < old.bot.y; y++) {
             // Remove if not in new.
             if (!rect.ContainsPoint(x, y)) {
-                coord_to_id.erase(Coord(c.x+x, c.y+y).ToKey());
-                printf("Removed point (%d, %d)\n", x, y);
+                coord_to_id.Set(c.x+x, c.y+y, 0);
+                Log("Removed point (%d, %d)\n", x, y);
             }
         }
     }
@@ -270,8 +807,8 @@ bool Maze::SetJunctionRect(JunctionID id, JunctionRect rect)
         for (int y = rect.top.y; y < rect.bot.y; y++) {
             // Add if not in old.
             if (!old.ContainsPoint(x, y)) {
-                coord_to_id[Coord(c.x+x, c.y+y).ToKey()] = id;
-                printf("Added point (%d, %d)\n", x, y);
+                coord_to_id.Set(c.x+x, c.y+y, id);
+                Log("Added point (%d, %d)\n", x, y);
             }
         }
     }
@@ -279,12 +816,18 @@ bool Maze::SetJunctionRect(JunctionID id, JunctionRect rect)
     // This way we deleted all the excess points and added the new points,
     // without having to add and remove all points.
     id_to_rect[id] = rect;
+    junction_reach.top = { min(junction_reach.top.x, rect.top.x), min(junction_reach.top.y, rect.top.y) };
+    junction_reach.bot = { max(junction_reach.bot.x, rect.bot.x), max(junction_reach.bot.y, rect.bot.y) };
+    Coord lo = { min(old.top.x, rect.top.x), min(old.top.y, rect.top.y) };
+    Coord hi = { max(old.bot.x, rect.bot.x) - 1, max(old.bot.y, rect.bot.y) - 1 };
+    Record(CHANGE_SET_RECT, id, 0, c + lo, c + hi);
     return true;
 }
 JunctionRect Maze::GetJunctionRect(JunctionID id)
 {
-    if (id_to_rect.find(id) != id_to_rect.end())
-        return id_to_rect[id];
+    auto it = id_to_rect.find(id);
+    if (it != id_to_rect.end())
+        return it->second;
     return {};
 }
 
@@ -295,7 +838,7 @@ void Maze::AddTunnel(JunctionID from, JunctionID to)
 {
     Tunnel t { from, to };
     if (!IsValidTunnel(t)) {
-        printf("Tunnel between %i and %i is not valid (existent or invalid)", t);
+        Log("Tunnel between %i and %i is not valid (existent or invalid)", t.from, t.to);
         return;
     }
 
@@ -303,15 +846,29 @@ void Maze::AddTunnel(JunctionID from, JunctionID to)
     Coord coord1 = GetJunctionCoord(from);
     Coord coord2 = GetJunctionCoord(to);
 
-    printf("Added tunnel from %i-%i\n", from, to);
+    Log("Added tunnel from %i-%i\n", from, to);
     tunnel_map[from][to] = 1;
     tunnel_map[to][from] = 1;
+    tunnel_index.Insert(t, coord1, coord2);
+    Record(CHANGE_ADD_TUNNEL, from, to, { min(coord1.x, coord2.x), min(coord1.y, coord2.y) },
+        { max(coord1.x, coord2.x), max(coord1.y, coord2.y) });
 }
 void Maze::RemoveTunnel(Tunnel t)
 {
-    tunnel_map[t.from].erase(t.to);
-    tunnel_map[t.to].erase(t.from);
-    printf("Removed tunnel from %i-%i\n", t.from, t.to);
+    // Nothing to journal for a tunnel that is not there.
+    if (!TunnelExists(t)) {
+        Log("Tunnel between %i and %i does not exist\n", t.from, t.to);
+        return;
+    }
+    Coord a = GetJunctionCoord(t.from);
+    Coord b = GetJunctionCoord(t.to);
+    tunnel_index.Erase(t, a, b);
+    tunnel_map.find(t.from)->second.erase(t.to);
+    auto back = tunnel_map.find(t.to);
+    if (back != tunnel_map.end())
+        back->second.erase(t.from);
+    Record(CHANGE_REMOVE_TUNNEL, t.from, t.to, { min(a.x, b.x), min(a.y, b.y) }, { max(a.x, b.x), max(a.y, b.y) });
+    Log("Removed tunnel from %i-%i\n", t.from, t.to);
 }
 bool Maze::IsValidTunnel(Tunnel t) {
     // Tunnel is valid when:
@@ -327,55 +884,19 @@ bool Maze::IsValidTunnel(Tunnel t) {
     if (diff.x != 0 && diff.y != 0)
         return false;
 
-    Coord coordmax = Coord(max(coord1.x, coord2.x), max(coord1.y, coord2.y));
-    Coord coordmin = Coord(min(coord1.x, coord2.x), min(coord1.y, coord2.y));
-
-    vector<Tunnel> tunnels = GetTunnelList();
-    for (Tunnel t: tunnels) {
-        Coord other1 = GetJunctionCoord(t.from);
-        Coord other2 = GetJunctionCoord(t.to);
-
-        Coord othermax = Coord(max(other1.x, other2.x), max(other1.y, other2.y));
-        Coord othermin = Coord(min(other1.x, other2.x), min(other1.y, other2.y));
-
-        if (coord1 == other1 || coord2 == other1 || coord1 == other2 || coord2 == other2)
-            continue;
-
-        bool fail1 = othermin.x <= coordmin.x && coordmin.x <= othermax.x &&
-            coordmin.y <= othermin.y && othermin.y <= coordmax.y;
-        bool fail2 = coordmin.x <= othermin.x && othermin.x <= coordmax.x &&
-            othermin.y <= coordmin.y && coordmin.y <= othermax.y;
-
-        if (fail1 || fail2)
-            return false;
-    }
-
-    return true;
+    return !tunnel_index.Overlaps(coord1, coord2);
 }
 bool Maze::TunnelExists(Tunnel t)
 {
-    if (tunnel_map.find(t.to) != tunnel_map.end()) {
-        auto map2 = tunnel_map[t.from];
-        return map2.find(t.to) != map2.end();
+    auto it = tunnel_map.find(t.from);
+    if (it != tunnel_map.end()) {
+        return it->second.find(t.to) != it->second.end();
     }
     return false;
 }
 Tunnel Maze::GetTunnelAt(int x, int y)
 {
-    vector<Tunnel> tunnels = GetTunnelList();
-    for (Tunnel t: tunnels) {
-        Coord other1 = GetJunctionCoord(t.from);
-        Coord other2 = GetJunctionCoord(t.to);
-
-        Coord othermax = Coord(max(other1.x, other2.x), max(other1.y, other2.y));
-        Coord othermin = Coord(min(other1.x, other2.x), min(other1.y, other2.y));
-        
-        if (x == other1.x && x == other2.x && othermin.y < y && y < othermax.y ||
-             y == other1.y && y == other2.y && othermin.x < x && x < othermax.x) {
-            return t;
-        } 
-    }
-    return { 0, 0 };
+    return tunnel_index.Find(x, y);
 }
 vector<Tunnel> Maze::GetTunnelList()
 {
@@ -393,139 +914,613 @@ vector<Tunnel> Maze::GetTunnelList()
 //
 // Tag methods.
 //
-vector<string> Maze::GetTagsAt(int x, int y)
+const vector<TagID> &Maze::GetTagsAt(int x, int y)
 {
     // Return if it exists, otherwise empty. We can't create tags with 
     // every query because queries will be numerous.
-    // Our system only includes non-empty tag lists.
-    CoordID key = Coord(x, y).ToKey();
-    if (coord_to_tags.find(key) != coord_to_tags.end()) {
-            return coord_to_tags[key];
-    }
-    return vector<string>();
+    // Cells without tags all share the empty list 0.
+    return tag_lists[coord_to_tags.Get(x, y)];
+}
+vector<string> Maze::GetTagNamesAt(int x, int y)
+{
+    vector<string> names;
+    for (TagID id: GetTagsAt(x, y))
+        names.push_back(GetTagName(id));
+    return names;
 }
 void Maze::SetTagsAt(int x, int y, vector<string> &tags)
+{
+    vector<TagID> ids;
+    ids.reserve(tags.size());
+    for (string &tag: tags)
+        ids.push_back(GetTagID(tag, true));
+    SetTagsAt(x, y, ids);
+}
+void Maze::SetTagsAt(int x, int y, vector<TagID> &tags)
 {
     // Set the tags at this location.
     // If the tag list is empty, the tags will be removed.
     CoordID key = Coord(x, y).ToKey();
+
+    // Move the cell between the index lists of the old and new tags.
+    uint32_t list = coord_to_tags.Get(x, y);
+    for (TagID tag: tag_lists[list]) {
+        if (find(tags.begin(), tags.end(), tag) == tags.end())
+            EraseSorted(tag_cells[tag], key);
+    }
+    for (TagID tag: tags)
+        InsertSorted(tag_cells[tag], key);
+
     if (tags.size() == 0) {
-        printf("Pruning empty tags at (%d, %d)\n", x, y);
-        coord_to_tags.erase(key);
+        Log("Pruning empty tags at (%d, %d)\n", x, y);
+        if (list != 0) {
+            vector<TagID>().swap(tag_lists[list]);
+            free_tag_lists.push_back(list);
+            coord_to_tags.Set(x, y, 0);
+        }
+        Record(CHANGE_SET_TAGS, 0, 0, Coord(x, y), Coord(x, y));
         return;
     }
 
-    // Now we can set the tags, newly created if nonexistent key.
-    printf("Updating tags at (%d, %d)\n", x, y);
-    coord_to_tags[key] = tags;
+    // Now we can set the tags, with a new list if the cell had none.
+    Log("Updating tags at (%d, %d)\n", x, y);
+    if (list == 0)
+        list = NewTagList();
+    // Set even an unchanged list, the block's revision has to move.
+    coord_to_tags.Set(x, y, list);
+    tag_lists[list] = tags;
+    Record(CHANGE_SET_TAGS, 0, 0, Coord(x, y), Coord(x, y));
+}
+uint32_t Maze::NewTagList()
+{
+    if (free_tag_lists.size() > 0) {
+        uint32_t list = free_tag_lists.back();
+        free_tag_lists.pop_back();
+        return list;
+    }
+    tag_lists.emplace_back();
+    return tag_lists.size()-1;
 }
 vector<TagCoord> Maze::GetTagsList()
 {
     vector<TagCoord> tagCoords;
-    for (auto pair: coord_to_tags) {
-        tagCoords.push_back(TagCoord(pair.second, pair.first));
-    }
+    coord_to_tags.ForEach([&](Coord c, uint32_t list) {
+        vector<string> names = GetTagNamesAt(c.x, c.y);
+        tagCoords.push_back(TagCoord(names, c));
+    });
     return tagCoords;
 }
+TagID Maze::GetTagID(string_view tag, bool create)
+{
+    if (!create)
+        return tag_pool.Find(tag);
+    TagID id = tag_pool.Intern(tag);
+    if (id >= tag_cells.size())
+        tag_cells.resize(id+1);
+    return id;
+}
+const string &Maze::GetTagName(TagID id)
+{
+    return tag_pool.Get(id);
+}
+const vector<CoordID> &Maze::GetTaggedCells(string tag)
+{
+    static const vector<CoordID> empty;
+    TagID id = GetTagID(tag);
+    return id != TAG_NONE ? tag_cells[id] : empty;
+}
+vector<CoordID> Maze::QueryTags(TagQuery &query)
+{
+    vector<CoordID> cells;
+    QueryTags(query, cells);
+    return cells;
+}
+void Maze::QueryTags(TagQuery &query, vector<CoordID> &cells)
+{
+    // Start from the smallest list that every result must be in and only
+    // look up the candidates in the others, so the cost follows the size
+    // of the answer rather than of the maze.
+    cells.clear();
+    vector<const vector<CoordID> *> all, any, none;
+    for (string &tag: query.all) {
+        TagID id = GetTagID(tag);
+        if (id == TAG_NONE)
+            return;
+        all.push_back(&tag_cells[id]);
+    }
+    for (string &tag: query.any) {
+        TagID id = GetTagID(tag);
+        if (id != TAG_NONE)
+            any.push_back(&tag_cells[id]);
+    }
+    for (string &tag: query.none) {
+        TagID id = GetTagID(tag);
+        if (id != TAG_NONE)
+            none.push_back(&tag_cells[id]);
+    }
+    if (query.any.size() > 0 && any.size() == 0)
+        return;
+    sort(all.begin(), all.end(), [](auto a, auto b) { return a->size() < b->size(); });
+
+    vector<CoordID> merged;
+    const vector<CoordID> *base;
+    if (all.size() > 0) {
+        base = all[0];
+    } else if (any.size() > 0) {
+        for (auto list: any)
+            merged.insert(merged.end(), list->begin(), list->end());
+        sort(merged.begin(), merged.end());
+        merged.erase(unique(merged.begin(), merged.end()), merged.end());
+        base = &merged;
+        any.clear();
+    } else {
+        coord_to_tags.ForEach([&](Coord c, uint32_t list) { merged.push_back(c.ToKey()); });
+        sort(merged.begin(), merged.end());
+        base = &merged;
+    }
+
+    // Candidates come in increasing order, so every list is searched
+    // forward from where the previous candidate was found.
+    vector<size_t> allPos(all.size(), 0), anyPos(any.size(), 0), nonePos(none.size(), 0);
+    auto keep = [&](CoordID key) {
+        for (int i = 1; i < all.size(); i++) {
+            if (!GallopTo(*all[i], allPos[i], key))
+                return false;
+        }
+        bool found = any.size() == 0;
+        for (int i = 0; i < any.size(); i++)
+            found |= GallopTo(*any[i], anyPos[i], key);
+        if (!found)
+            return false;
+        for (int i = 0; i < none.size(); i++) {
+            if (GallopTo(*none[i], nonePos[i], key))
+                return false;
+        }
+        return true;
+    };
+
+    if (!query.hasArea) {
+        for (CoordID key: *base) {
+            if (keep(key))
+                cells.push_back(key);
+        }
+        return;
+    }
+
+    // Keys sort by x and then y, so walk the columns of the area and jump
+    // over the part of each column outside of it.
+    Coord lo = query.lo, hi = query.hi;
+    auto it = lower_bound(base->begin(), base->end(), Coord(lo.x, lo.y).ToKey());
+    CoordID end = Coord(hi.x, hi.y).ToKey();
+    while (it != base->end() && *it <= end) {
+        Coord c = Coord(*it);
+        if (c.y < lo.y) {
+            it = lower_bound(it, base->end(), Coord(c.x, lo.y).ToKey());
+        } else if (c.y > hi.y) {
+            if (c.x == INT_MAX)
+                break;
+            it = lower_bound(it, base->end(), Coord(c.x+1, lo.y).ToKey());
+        } else {
+            if (keep(*it))
+                cells.push_back(*it);
+            it++;
+        }
+    }
+}
 
 //
-// IO methods.
+// Area methods.
 //
-bool Maze::ExportJson(fs::path filePath)
+static CoordID BucketKey(Coord coord)
+{
+    return Coord(coord.x >> JUNCTION_BUCKET_BITS, coord.y >> JUNCTION_BUCKET_BITS).ToKey();
+}
+void Maze::InsertBucket(JunctionID id, Coord coord)
+{
+    junction_buckets[BucketKey(coord)].push_back({ id, coord });
+    junction_lo = { min(junction_lo.x, coord.x), min(junction_lo.y, coord.y) };
+    junction_hi = { max(junction_hi.x, coord.x), max(junction_hi.y, coord.y) };
+}
+void Maze::EraseBucket(JunctionID id, Coord coord)
+{
+    auto it = junction_buckets.find(BucketKey(coord));
+    if (it == junction_buckets.end())
+        return;
+    vector<JunctionCoord> &bucket = it->second;
+    auto pos = find_if(bucket.begin(), bucket.end(), [&](JunctionCoord &jc) { return jc.id == id; });
+    if (pos != bucket.end()) {
+        *pos = bucket.back();
+        bucket.pop_back();
+    }
+    if (bucket.empty())
+        junction_buckets.erase(it);
+}
+void Maze::QueryJunctions(Coord lo, Coord hi, vector<JunctionID> &junctions)
 {
-    // Here we get all vertices and push them back.
-    json junclist;
+    // Replaces the list with the junctions whose rectangle touches the
+    // area. A rectangle reaches at most junction_reach from its coordinate,
+    // so only the buckets in the area grown by that can hold them.
+    junctions.clear();
+    int64_t cx0 = (int64_t)lo.x - junction_reach.bot.x + 1;
+    int64_t cy0 = (int64_t)lo.y - junction_reach.bot.y + 1;
+    int64_t cx1 = (int64_t)hi.x - junction_reach.top.x;
+    int64_t cy1 = (int64_t)hi.y - junction_reach.top.y;
+    int64_t x0 = cx0 >> JUNCTION_BUCKET_BITS, y0 = cy0 >> JUNCTION_BUCKET_BITS;
+    int64_t x1 = cx1 >> JUNCTION_BUCKET_BITS, y1 = cy1 >> JUNCTION_BUCKET_BITS;
+    if (x1 < x0 || y1 < y0)
+        return;
+
+    // While every rectangle is a single cell the coordinate decides.
+    bool single = junction_reach == JunctionRect({ 0, 0 }, { 1, 1 });
+    auto visit = [&](vector<JunctionCoord> &bucket) {
+        for (JunctionCoord &jc: bucket) {
+            Coord c = jc.coord;
+            if (c.x < cx0 || c.x > cx1 || c.y < cy0 || c.y > cy1)
+                continue;
+            if (!single) {
+                JunctionRect &r = id_to_rect[jc.id];
+                if (c.x+r.top.x > hi.x || c.x+r.bot.x <= lo.x || c.y+r.top.y > hi.y || c.y+r.bot.y <= lo.y)
+                    continue;
+            }
+            junctions.push_back(jc.id);
+        }
+    };
 
-    string output = "{\n";
-    output += TextFormat("\t\"mazeName\": \"%s\",\n", name.c_str());
+    // With most of the maze in the area, walking all buckets is cheaper
+    // than looking each one up.
+    if ((x1-x0+1) * (y1-y0+1) > (int64_t)junction_buckets.size()) {
+        for (auto &pair: junction_buckets) {
+            Coord b = Coord(pair.first);
+            if (b.x >= x0 && b.x <= x1 && b.y >= y0 && b.y <= y1)
+                visit(pair.second);
+        }
+        return;
+    }
+    for (int64_t x = x0; x <= x1; x++) {
+        for (int64_t y = y0; y <= y1; y++) {
+            auto it = junction_buckets.find(Coord((int)x, (int)y).ToKey());
+            if (it != junction_buckets.end())
+                visit(it->second);
+        }
+    }
+}
+void Maze::QueryTunnels(Coord lo, Coord hi, vector<Tunnel> &tunnels)
+{
+    // Replaces the list with the tunnels crossing the area. Only straight
+    // tunnels are indexed, Validate() reports the others.
+    tunnels.clear();
+    tunnel_index.Query(lo, hi, tunnels);
+}
+bool Maze::GetBounds(Coord &lo, Coord &hi)
+{
+    // Cells that junctions and tunnels may cover, false while the maze
+    // never had a junction.
+    if (junction_lo.x > junction_hi.x)
+        return false;
+    lo = { junction_lo.x + min(junction_reach.top.x, 0), junction_lo.y + min(junction_reach.top.y, 0) };
+    hi = { junction_hi.x + max(junction_reach.bot.x-1, 0), junction_hi.y + max(junction_reach.bot.y-1, 0) };
+    return true;
+}
 
-    vector<JunctionID> junctions = GetJunctionList();
-    output += "\t\"junctions\": [\n";
-    for (int i = 0; i < junctions.size(); i++) {
-        JunctionID id = junctions[i];
-        Junction &j = GetJunction(id);
-        Coord coords = GetJunctionCoord(id);
-        JunctionRect jr = GetJunctionRect(id);
-        output += TextFormat("\t\t[ \"%s\", %d, %d, %d, %d, %d, %d, %d ]%s\n",
-            j.name.c_str(), j.id, coords.x, coords.y, jr.top.x, jr.top.y, jr.bot.x, jr.bot.y, i < junctions.size()-1 ? "," : "");
+//
+// Bulk methods.
+//
+void Maze::Reserve(size_t junctions)
+{
+    // Makes room for that many more junctions up front, so they can come
+    // in over many batches without the maps growing in between.
+    id_to_junction.reserve(id_to_junction.size() + junctions);
+    id_to_rect.reserve(id_to_rect.size() + junctions);
+    id_to_coord.reserve(id_to_coord.size() + junctions);
+    coord_to_id.Reserve(junctions);
+    tunnel_map.reserve(tunnel_map.size() + junctions);
+}
+void Maze::BulkInsert(vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels, vector<TagCoord> &tags)
+{
+    // Trusted insertion, nothing is checked or split here. The records are
+    // moved out of the vectors. Use Validate() afterwards when in doubt.
+    // The change covers every cell inserted.
+    Coord lo = { INT_MAX, INT_MAX };
+    Coord hi = { INT_MIN, INT_MIN };
+    auto grow = [&](Coord a, Coord b) {
+        lo = { min(lo.x, a.x), min(lo.y, a.y) };
+        hi = { max(hi.x, b.x), max(hi.y, b.y) };
     };
-    output += "\t],\n";
+    ReserveMore(id_to_junction, junctions.size());
+    ReserveMore(id_to_rect, junctions.size());
+    ReserveMore(id_to_coord, junctions.size());
+    coord_to_id.Reserve(junctions.size());
+    ReserveMore(tunnel_map, junctions.size());
+    coord_to_tags.Reserve(tags.size());
 
-    // Here we get all edges and push them back.
-    output += "\t\"tunnels\": [\n";
-    vector<Tunnel> tunnels = GetTunnelList();
-    for (int i = 0; i < tunnels.size(); i++) {
-        Tunnel t = tunnels[i];
-        output += TextFormat("\t\t[ %d, %d ]%s\n", t.from, t.to, i < tunnels.size()-1 ? "," : "");
+    for (JunctionRecord &r: junctions) {
+        // A repeated ID would leave the name and cells of the first
+        // junction pointing at the second. The first one stays, Validate()
+        // reports the others.
+        auto inserted = id_to_junction.try_emplace(r.id);
+        if (!inserted.second) {
+            duplicate_ids.push_back(r.id);
+            Log("Junction ID %u repeats, skipped\n", r.id);
+            continue;
+        }
+        StringHandle handle = name_pool.Intern(r.name);
+        name_to_id.emplace(name_pool.Get(handle), r.id);
+        inserted.first->second = Junction(handle, r.id);
+        id_to_rect[r.id] = r.rect;
+        id_to_coord[r.id] = r.coord;
+        InsertBucket(r.id, r.coord);
+        grow(r.coord + r.rect.top, r.coord + r.rect.bot - Coord(1, 1));
+        junction_reach.top = { min(junction_reach.top.x, r.rect.top.x), min(junction_reach.top.y, r.rect.top.y) };
+        junction_reach.bot = { max(junction_reach.bot.x, r.rect.bot.x), max(junction_reach.bot.y, r.rect.bot.y) };
+        for (int x = r.rect.top.x; x < r.rect.bot.x; x++) {
+            for (int y = r.rect.top.y; y < r.rect.bot.y; y++) {
+                coord_to_id.Set(r.coord.x+x, r.coord.y+y, r.id);
+            }
+        }
     }
-    output += "\t],\n";
 
-    // Here we get all the edges and push them back.
-    vector<TagCoord> tagCoords = GetTagsList();
-    output += "\t\"tags\": [\n";
-    for (int i = 0; i < tagCoords.size(); i++) {
-        TagCoord tc = tagCoords[i];
-        output += TextFormat("\t\t[ %d, %d, [ ", tc.coord.x, tc.coord.y);
+    for (Tunnel t: tunnels) {
+        // The tunnel index would keep such a tunnel after tunnel_map lost
+        // it, or never had it. Validate() reports them.
+        if (t.from == t.to || !JunctionExists(t.from) || !JunctionExists(t.to) || TunnelExists(t)) {
+            skipped_tunnels.push_back(t);
+            Log("Tunnel %u-%u is invalid or repeats, skipped\n", t.from, t.to);
+            continue;
+        }
+        tunnel_map[t.from][t.to] = 1;
+        tunnel_map[t.to][t.from] = 1;
+        Coord a = GetJunctionCoord(t.from);
+        Coord b = GetJunctionCoord(t.to);
+        if (a.x == b.x || a.y == b.y)
+            tunnel_index.Insert(t, a, b);
+        grow({ min(a.x, b.x), min(a.y, b.y) }, { max(a.x, b.x), max(a.y, b.y) });
+    }
 
-        for (int j = 0; j < tc.tags.size(); j++) {
-            string s = tc.tags[j];
-            output += TextFormat("\"%s\"%s ", s.c_str(), j < tc.tags.size()-1 ? "," : "");
+    // New cells are appended to the index lists, which are sorted once at
+    // the end. Cells that already had tags go through SetTagsAt after.
+    vector<char> touched(tag_cells.size(), 0);
+    vector<TagCoord *> retagged;
+    for (TagCoord &tc: tags) {
+        if (tc.tags.size() == 0)
+            continue;
+        grow(tc.coord, tc.coord);
+        CoordID key = tc.coord.ToKey();
+        if (coord_to_tags.Get(tc.coord.x, tc.coord.y) != 0) {
+            retagged.push_back(&tc);
+            continue;
         }
+        uint32_t list = NewTagList();
+        coord_to_tags.Set(tc.coord.x, tc.coord.y, list);
+        vector<TagID> &ids = tag_lists[list];
+        for (string &tag: tc.tags) {
+            TagID id = GetTagID(tag, true);
+            if (id >= touched.size())
+                touched.resize(id+1, 0);
+            touched[id] = 1;
+            tag_cells[id].push_back(key);
+            ids.push_back(id);
+        }
+    }
+    for (TagID id = 0; id < touched.size(); id++) {
+        if (!touched[id])
+            continue;
+        vector<CoordID> &cells = tag_cells[id];
+        sort(cells.begin(), cells.end());
+        cells.erase(unique(cells.begin(), cells.end()), cells.end());
+    }
+    bool wasVerbose = verbose;
+    verbose = false;
+    for (TagCoord *tc: retagged)
+        SetTagsAt(tc->coord.x, tc->coord.y, tc->tags);
+    verbose = wasVerbose;
+    if (lo.x > hi.x)
+        lo = hi = Coord(0, 0);
+    Record(CHANGE_BULK_INSERT, 0, 0, lo, hi);
+}
+vector<string> Maze::Validate(bool report)
+{
+    // Runs every check the incremental methods do, over the whole maze,
+    // and reports all the conflicts found instead of stopping at one.
+    vector<string> conflicts;
 
-        output += TextFormat("]]%s\n", i < tagCoords.size()-1 ? "," : "");
+    for (JunctionID id: duplicate_ids)
+        conflicts.push_back("Junction " + to_string(id) + " appears more than once");
+    for (Tunnel t: skipped_tunnels) {
+        string tunnel = "Tunnel " + to_string(t.from) + "-" + to_string(t.to);
+        if (t.from == t.to)
+            conflicts.push_back(tunnel + " connects a junction to itself");
+        else if (!JunctionExists(t.from) || !JunctionExists(t.to))
+            conflicts.push_back(tunnel + " connects a missing junction");
+        else
+            conflicts.push_back(tunnel + " appears more than once");
     }
-    output += "\t]\n";
 
-    output += "}";
-    ofstream file(filePath);
-    if (!file.good())
+    for (auto &kv: id_to_junction) {
+        JunctionID id = kv.first;
+        Coord c = GetJunctionCoord(id);
+        JunctionRect r = GetJunctionRect(id);
+        if (!(r.top.x < r.bot.x && r.top.y < r.bot.y)) {
+            conflicts.push_back("Junction " + to_string(id) + " has an empty rectangle");
+            continue;
+        }
+        for (int x = r.top.x; x < r.bot.x; x++) {
+            for (int y = r.top.y; y < r.bot.y; y++) {
+                JunctionID other = GetJunctionAt(c.x+x, c.y+y);
+                if (other != id) {
+                    conflicts.push_back("Junction " + to_string(id) + " overlaps junction " + to_string(other) + 
+                        " at (" + to_string(c.x+x) + ", " + to_string(c.y+y) + ")");
+                }
+            }
+        }
+    }
+
+    for (Tunnel t: GetTunnelList()) {
+        string tunnel = "Tunnel " + to_string(t.from) + "-" + to_string(t.to);
+        if (!JunctionExists(t.from) || !JunctionExists(t.to)) {
+            conflicts.push_back(tunnel + " connects a missing junction");
+            continue;
+        }
+        Coord a = GetJunctionCoord(t.from);
+        Coord b = GetJunctionCoord(t.to);
+        if (a.x != b.x && a.y != b.y) {
+            conflicts.push_back(tunnel + " is not colinear");
+            continue;
+        }
+        if (tunnel_index.Overlaps(a, b))
+            conflicts.push_back(tunnel + " overlaps another tunnel");
+    }
+
+    if (report) {
+        for (string &c: conflicts)
+            printf("%s\n", c.c_str());
+        if (conflicts.size() > 0)
+            printf("Maze \"%s\" has %d conflicts\n", name.c_str(), (int)conflicts.size());
+    }
+    return conflicts;
+}
+
+//
+// IO methods.
+//
+bool Maze::ExportJson(fs::path filePath, bool atomic)
+{
+    // Stream straight into the file.
+    FileWriter out(filePath, atomic);
+    if (!out.IsOpen())
+        return false;
+
+    out.Write("{\n\t\"mazeName\": ");
+    out.WriteString(name);
+    out.Write(",\n");
+
+    // Every list writes its separator in front of the next element. The
+    // maps keep no order, so every list is sorted first, junctions and
+    // tunnels by ID and tags by coordinate, and the same maze always
+    // gives the same file.
+    vector<JunctionID> junctions;
+    junctions.reserve(id_to_junction.size());
+    for (auto &kv: id_to_junction)
+        junctions.push_back(kv.first);
+    sort(junctions.begin(), junctions.end());
+    out.Write("\t\"junctions\": [\n");
+    const char *sep = "";
+    for (JunctionID id: junctions) {
+        Junction &j = GetJunction(id);
+        Coord coords = GetJunctionCoord(j.id);
+        JunctionRect jr = GetJunctionRect(j.id);
+        int64_t values[] = { j.id, coords.x, coords.y, jr.top.x, jr.top.y, jr.bot.x, jr.bot.y };
+        out.Write(sep);
+        out.Write("\t\t[ ");
+        out.WriteString(name_pool.Get(j.name));
+        for (int64_t v: values) {
+            out.Write(", ");
+            out.WriteInt(v);
+        }
+        out.Write(" ]");
+        sep = ",\n";
+    };
+    out.Write(id_to_junction.empty() ? "\t],\n" : "\n\t],\n");
+
+    vector<Tunnel> tunnels;
+    for (auto &pair1: tunnel_map) {
+        for (auto &pair2: pair1.second) {
+            if (pair1.first < pair2.first)
+                tunnels.push_back({ pair1.first, pair2.first });
+        }
+    }
+    sort(tunnels.begin(), tunnels.end(), [](Tunnel a, Tunnel b) {
+        return a.from < b.from || (a.from == b.from && a.to < b.to);
+    });
+    out.Write("\t\"tunnels\": [\n");
+    sep = "";
+    for (Tunnel t: tunnels) {
+        out.Write(sep);
+        out.Write("\t\t[ ");
+        out.WriteInt(t.from);
+        out.Write(", ");
+        out.WriteInt(t.to);
+        out.Write(" ]");
+        sep = ",\n";
+    }
+    out.Write(tunnels.empty() ? "\t],\n" : "\n\t],\n");
+
+    vector<pair<Coord, uint32_t>> tagged;
+    tagged.reserve(coord_to_tags.Size());
+    coord_to_tags.ForEach([&](Coord coord, uint32_t list) {
+        tagged.push_back({ coord, list });
+    });
+    sort(tagged.begin(), tagged.end(), [](const pair<Coord, uint32_t> &a, const pair<Coord, uint32_t> &b) {
+        return a.first.y < b.first.y || (a.first.y == b.first.y && a.first.x < b.first.x);
+    });
+    out.Write("\t\"tags\": [\n");
+    sep = "";
+    for (auto &[coord, list]: tagged) {
+        out.Write(sep);
+        out.Write("\t\t[ ");
+        out.WriteInt(coord.x);
+        out.Write(", ");
+        out.WriteInt(coord.y);
+        out.Write(", [ ");
+        vector<TagID> &tags = tag_lists[list];
+        for (int i = 0; i < tags.size(); i++) {
+            out.WriteString(tag_pool.Get(tags[i]));
+            out.Write(i < tags.size()-1 ? ", " : " ");
+        }
+        out.Write("]]");
+        sep = ",\n";
+    }
+    out.Write(tagged.empty() ? "\t]\n}" : "\n\t]\n}");
+
+    if (!out.Close())
         return false;
-    file << output;
-    file.close();
 
-    printf("Written maze \"%s\" to json \"%s\"", name.c_str(), filePath.string().c_str());
+    Log("Written maze \"%s\" to json \"%s\"", name.c_str(), filePath.string().c_str());
     return true;
 }
-bool Maze::ImportJson(fs::path filePath)
+bool Maze::ImportJson(fs::path filePath, bool validate)
 {
     ifstream stream(filePath);
     if (!stream.good())
         return false;
     json imported = json::parse(stream);
     stream.close();
-    name = imported["mazeName"];
-    Erase();
 
-    json juncs = imported["junctions"];
-    for (json junction: juncs) {
-        string s = junction.at(0);
-        JunctionID id = junction.at(1);
-        int x = junction.at(2);
-        int y = junction.at(3);
-
-        JunctionRect jr;
-        jr.top.x = junction.at(4);
-        jr.top.y = junction.at(5);
-        jr.bot.x = junction.at(6);
-        jr.bot.y = junction.at(7);
-
-        AddJunction(x, y, s, id);
-        SetJunctionRect(id, jr);
+    // Collect everything first, the maze is filled in one go afterwards.
+    json &juncs = imported["junctions"];
+    vector<JunctionRecord> junctions;
+    junctions.reserve(juncs.size());
+    for (json &junction: juncs) {
+        JunctionRecord r;
+        r.name = junction.at(0);
+        r.id = junction.at(1);
+        r.coord.x = junction.at(2);
+        r.coord.y = junction.at(3);
+        r.rect.top.x = junction.at(4);
+        r.rect.top.y = junction.at(5);
+        r.rect.bot.x = junction.at(6);
+        r.rect.bot.y = junction.at(7);
+        junctions.push_back(move(r));
     }
 
-    json tunnels = imported["tunnels"];
-    for (json tunnel: tunnels) {
+    json &tuns = imported["tunnels"];
+    vector<Tunnel> tunnels;
+    tunnels.reserve(tuns.size());
+    for (json &tunnel: tuns) {
         JunctionID j1 = tunnel.at(0);
         JunctionID j2 = tunnel.at(1);
-        AddTunnel(j1, j2);
+        tunnels.push_back({ j1, j2 });
     }
 
-    json tags = imported["tags"];
-    for (json tagCoord: tags) {
-        int tx = tagCoord.at(0);
-        int ty =  tagCoord.at(1);
-        vector<string> vec = tagCoord.at(2).get<vector<string>>();
-        SetTagsAt(tx, ty, vec);
+    json &tagList = imported["tags"];
+    vector<TagCoord> tags;
+    tags.reserve(tagList.size());
+    for (json &tagCoord: tagList) {
+        TagCoord tc;
+        tc.coord.x = tagCoord.at(0);
+        tc.coord.y = tagCoord.at(1);
+        tc.tags = tagCoord.at(2).get<vector<string>>();
+        tags.push_back(move(tc));
     }
-    return true;
+
+    return Load(imported["mazeName"], junctions, tunnels, tags, validate);
 }
\ No newline at end of file
@@ -2,16 +2,26 @@
 #define MAZE_H
 
 #include <string>
+#include <map>
+#include <set>
 #include <unordered_map>
 #include <vector>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include "string_pool.h"
 
 using namespace std;
 namespace fs = filesystem;
 
 typedef uint32_t JunctionID;
-typedef string CoordID;
+typedef uint64_t CoordID;
+typedef uint32_t TagID;
+
+#define TAG_NONE UINT32_MAX
+// Junctions are bucketed by squares of 2^JUNCTION_BUCKET_BITS cells for
+// area queries.
+#define JUNCTION_BUCKET_BITS 4
 
 // Structure to represent simply an int vector.
 struct Coord {
@@ -20,20 +30,35 @@ struct Coord {
 
     Coord();
     Coord(int x, int y);
-    Coord(CoordID key);
+    explicit Coord(CoordID key);
     Coord operator+(const Coord &other);
     Coord operator-(const Coord &other);
     bool operator==(const Coord &other);
     CoordID ToKey();
 };
 
+// Hash for packed coordinates. The packed key keeps x and y in separate
+// halves, so mix the bits before they end up in a bucket index.
+struct CoordHash {
+    size_t operator()(CoordID key) const
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+};
+
 // Structure to represent a junction with its associated data.
+// The name is a handle into the name pool of the maze.
 struct Junction {
-    string name;
+    StringHandle name;
     JunctionID id;
 
     Junction();
-    Junction(string _name, JunctionID _id);
+    Junction(StringHandle _name, JunctionID _id);
 };
 
 struct JunctionRect {
@@ -42,6 +67,21 @@ struct JunctionRect {
     JunctionRect();
     JunctionRect(Coord top, Coord bot);
     bool ContainsPoint(int x, int y);
+    bool operator==(const JunctionRect &other);
+};
+
+// Plain junction data, used to load many junctions at once.
+struct JunctionRecord {
+    string name;
+    JunctionID id;
+    Coord coord;
+    JunctionRect rect;
+};
+
+// Junction and coordinate, as kept in the area buckets.
+struct JunctionCoord {
+    JunctionID id;
+    Coord coord;
 };
 
 struct Tunnel {
@@ -49,6 +89,117 @@ struct Tunnel {
     JunctionID to;
 };
 
+// Index of the axis-aligned tunnel segments. Every row and column keeps
+// its segments sorted by their lowest coordinate, so point and overlap
+// queries only look at the few segments that can reach the query.
+class TunnelIndex {
+private:
+    struct Span {
+        int lo;
+        int hi;
+        Tunnel tunnel;
+    };
+    struct Line {
+        multimap<int, Span> spans;
+        int maxLength = 0;
+    };
+    map<int, Line> rows;
+    map<int, Line> cols;
+    // Count of changes, and per block of GRID_CHUNK_SIZE cells the count
+    // at the last change of a segment through it, as in CellGrid.
+    uint64_t revision = 0;
+    unordered_map<CoordID, uint64_t, CoordHash> blockRevisions;
+
+    void Stamp(Coord a, Coord b);
+
+    static bool FindInterior(map<int, Line> &lines, int line, int pos, Span &out);
+    static void QueryLines(map<int, Line> &lines, int first, int last, int lo, int hi, vector<Tunnel> &tunnels);
+
+public:
+    void Insert(Tunnel t, Coord a, Coord b);
+    void Erase(Tunnel t, Coord a, Coord b);
+    Tunnel Find(int x, int y);
+    bool Overlaps(Coord a, Coord b);
+    void Query(Coord lo, Coord hi, vector<Tunnel> &tunnels);
+    void Clear();
+    void ContinueFrom(TunnelIndex &other);
+    uint64_t GetRevision(int bx, int by);
+};
+
+// Where a CellGrid keeps its cells. The hash backend stores only the cells
+// in use and suits sparse mazes. The chunked backend stores square chunks
+// of cells in flat arrays, allocated when their first cell is set, so a
+// lookup is two array indexes and neighboring cells share cache lines.
+enum GridBackend {
+    GRID_HASH,
+    GRID_CHUNKED
+};
+
+#define GRID_CHUNK_BITS 6
+#define GRID_CHUNK_SIZE (1 << GRID_CHUNK_BITS)
+#define GRID_CHUNK_CELLS (GRID_CHUNK_SIZE * GRID_CHUNK_SIZE)
+// The chunk directory spans the bounding box of the chunks in use. A grid
+// spread over more chunks than this goes back to the hash backend.
+#define GRID_MAX_CHUNKS (1 << 20)
+
+// Map from cells to 32 bit values, where 0 means the cell is unset.
+class CellGrid {
+private:
+    GridBackend backend = GRID_HASH;
+    unordered_map<CoordID, uint32_t, CoordHash> cells;
+    // Set cells of the chunked backend.
+    size_t count = 0;
+    // Chunks in row order over the directory, empty when nothing is set.
+    // Cells within a chunk are in row order too.
+    vector<vector<uint32_t>> chunks;
+    vector<uint32_t> chunkCounts;
+    int chunkX = 0;
+    int chunkY = 0;
+    int chunkW = 0;
+    int chunkH = 0;
+    // Count of changes, and per block of GRID_CHUNK_SIZE cells the count
+    // at its last change. Cached views of a block compare it to see if
+    // they are stale. Clear() keeps counting.
+    uint64_t revision = 0;
+    unordered_map<CoordID, uint64_t, CoordHash> blockRevisions;
+
+    bool GrowDirectory(int cx, int cy);
+
+public:
+    GridBackend GetBackend();
+    void SetBackend(GridBackend backend);
+    uint32_t Get(int x, int y);
+    void Set(int x, int y, uint32_t value);
+    void Clear();
+    void ContinueFrom(CellGrid &other);
+    void Reserve(size_t extra);
+    size_t Size();
+    uint64_t GetRevision(int bx, int by);
+
+    // Calls f(coord, value) for every set cell. The chunked backend goes
+    // chunk by chunk. The grid must not change during the walk.
+    template <typename F>
+    void ForEach(F f)
+    {
+        if (backend == GRID_HASH) {
+            for (auto &pair: cells)
+                f(Coord(pair.first), pair.second);
+            return;
+        }
+        for (size_t i = 0; i < chunks.size(); i++) {
+            vector<uint32_t> &chunk = chunks[i];
+            if (chunk.empty())
+                continue;
+            int x0 = (chunkX + (int)(i % chunkW)) * GRID_CHUNK_SIZE;
+            int y0 = (chunkY + (int)(i / chunkW)) * GRID_CHUNK_SIZE;
+            for (int k = 0; k < GRID_CHUNK_CELLS; k++) {
+                if (chunk[k] != 0)
+                    f(Coord(x0 + (k & (GRID_CHUNK_SIZE-1)), y0 + (k >> GRID_CHUNK_BITS)), chunk[k]);
+            }
+        }
+    }
+};
+
 struct TagCoord {
     TagCoord();
     TagCoord(vector<string> &tags, Coord coord);
@@ -56,10 +207,59 @@ struct TagCoord {
     Coord coord;
 };
 
+// Cells to find by their tags: every tag of all, at least one tag of any
+// when given, and none of the tags of none. With hasArea only the cells
+// from lo to hi (inclusive) count.
+struct TagQuery {
+    vector<string> all;
+    vector<string> any;
+    vector<string> none;
+    bool hasArea = false;
+    Coord lo;
+    Coord hi;
+};
+
+// Every edit bumps the version by one and appends a change to the
+// journal, a ring of the latest MAZE_JOURNAL_SIZE changes.
+#define MAZE_JOURNAL_SIZE 4096
+
+enum ChangeKind {
+    CHANGE_ADD_JUNCTION,
+    CHANGE_REMOVE_JUNCTION,
+    CHANGE_RENAME_JUNCTION,
+    CHANGE_SET_RECT,
+    CHANGE_ADD_TUNNEL,
+    CHANGE_REMOVE_TUNNEL,
+    CHANGE_SET_TAGS,
+    // Many junctions, tunnels and tags at once.
+    CHANGE_BULK_INSERT,
+    // The maze was erased or replaced, everything changed.
+    CHANGE_ERASE
+};
+
+// One edit. Junction changes carry the junction in id, tunnel changes
+// both ends in id and other. The cells the change touched lie from lo to
+// hi, both inclusive.
+struct MazeChange {
+    uint64_t version;
+    ChangeKind kind;
+    JunctionID id;
+    JunctionID other;
+    Coord lo;
+    Coord hi;
+};
+
+typedef function<void(const MazeChange &)> ChangeCallback;
+
 class Maze {
 public:
     string name;
 
+    // Bumped by every edit, so derived data can tell when it is stale.
+    uint64_t version = 0;
+    // Print every edit, batch tools turn this off.
+    bool verbose = true;
+
     // Natural bijections of data access:
     // junctionID -> Junction
     // junctionID -> JunctionRect
@@ -68,25 +268,83 @@ public:
     unordered_map<JunctionID, Junction> id_to_junction;
     unordered_map<JunctionID, JunctionRect> id_to_rect;
     unordered_map<JunctionID, Coord> id_to_coord;
-    unordered_map<CoordID, JunctionID> coord_to_id;
-    
+    CellGrid coord_to_id;
+
     unordered_map<JunctionID, unordered_map<JunctionID, int>> tunnel_map;
-    unordered_map<CoordID, vector<string>> coord_to_tags;
+    // Cell -> index into tag_lists. List 0 is the empty list, lists of
+    // cleared cells are reused.
+    CellGrid coord_to_tags;
+    vector<vector<TagID>> tag_lists;
+    vector<uint32_t> free_tag_lists;
+    // Names and tags are interned, junctions and cells only keep handles.
+    // A tag id is the handle of the tag in tag_pool.
+    StringPool name_pool;
+    StringPool tag_pool;
+    // Inverted tag index. Every tag id lists its cells as sorted packed
+    // coordinates, so a column of cells is one contiguous run.
+    vector<vector<CoordID>> tag_cells;
+    // Junction names, sorted for prefix search. Names may repeat, the ID
+    // in the key finds one junction among many of the same name. The
+    // keys view the strings in name_pool.
+    set<pair<string_view, JunctionID>> name_to_id;
+    // IDs BulkInsert() skipped because a junction already had them, for
+    // Validate() to report.
+    vector<JunctionID> duplicate_ids;
+    // Tunnels BulkInsert() skipped because they repeat a tunnel, loop back
+    // to their junction or connect a missing one, for Validate() to report.
+    vector<Tunnel> skipped_tunnels;
+    TunnelIndex tunnel_index;
+    // Junctions by the bucket their coordinate lies in, and the union of
+    // all junction rectangles, so area queries know how far to look. The
+    // coordinates of all junctions lie from junction_lo to junction_hi.
+    // Reach and bounds only grow.
+    unordered_map<CoordID, vector<JunctionCoord>, CoordHash> junction_buckets;
+    JunctionRect junction_reach;
+    Coord junction_lo;
+    Coord junction_hi;
+    // The change with version v is at (v-1) % MAZE_JOURNAL_SIZE, the
+    // journal holds the changes after version journal_start.
+    vector<MazeChange> journal;
+    uint64_t journal_start = 0;
+    vector<pair<int, ChangeCallback>> subscribers;
+    int next_subscriber = 1;
 
+    // name_to_id views the strings of name_pool, a copy would view the
+    // pool of the maze it was copied from. Moving keeps the strings where
+    // they are.
     Maze();
+    Maze(const Maze &other) = delete;
+    Maze(Maze &&other) = default;
+    Maze &operator=(const Maze &other) = delete;
+    Maze &operator=(Maze &&other) = default;
     void Erase();
+    void Log(const char *format, ...);
+
+    // Change methods.
+    bool GetChanges(uint64_t since, vector<MazeChange> &changes);
+    int Subscribe(ChangeCallback callback);
+    void Unsubscribe(int subscriber);
+
+    // Grid methods.
+    GridBackend GetGridBackend();
+    void SetGridBackend(GridBackend backend);
 
     // Junction methods.
-    void AddJunction(int x, int y, string name, JunctionID id=0);
+    void AddJunction(int x, int y, string name, JunctionID id=0, bool split=true);
     void RemoveJunction(JunctionID id);
     bool JunctionExists(JunctionID id);
 
     JunctionID GetJunctionAt(int x, int y);
     Junction& GetJunction(JunctionID id);
     Coord GetJunctionCoord(JunctionID id);
+    const string &GetJunctionName(JunctionID id);
+    bool RenameJunction(JunctionID id, string name);
     JunctionID FindJunction(string name);
+    vector<JunctionID> FindJunctions(string name);
+    vector<JunctionID> FindJunctionsByPrefix(string prefix, int limit=-1);
     vector<JunctionID> GetJunctionList();
     vector<JunctionID> GetConnectedJunctions(JunctionID source);
+    bool IsPrunable(JunctionID id, vector<JunctionID> &connected);
     void PruneJunctions();
 
     // JunctionRect methods.
@@ -102,13 +360,42 @@ public:
     vector<Tunnel> GetTunnelList();
 
     // Tag methods.
-    vector<string> GetTagsAt(int x, int y);
+    const vector<TagID> &GetTagsAt(int x, int y);
+    vector<string> GetTagNamesAt(int x, int y);
     void SetTagsAt(int x, int y, vector<string> &tags);
+    void SetTagsAt(int x, int y, vector<TagID> &tags);
     vector<TagCoord> GetTagsList(); 
+    TagID GetTagID(string_view tag, bool create=false);
+    const string &GetTagName(TagID id);
+    const vector<CoordID> &GetTaggedCells(string tag);
+    vector<CoordID> QueryTags(TagQuery &query);
+    void QueryTags(TagQuery &query, vector<CoordID> &cells);
+
+    // Area methods. Both corners are inclusive.
+    void QueryJunctions(Coord lo, Coord hi, vector<JunctionID> &junctions);
+    void QueryTunnels(Coord lo, Coord hi, vector<Tunnel> &tunnels);
+    bool GetBounds(Coord &lo, Coord &hi);
+
+    // Bulk methods.
+    void Reserve(size_t junctions);
+    void BulkInsert(vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels, vector<TagCoord> &tags);
+    vector<string> Validate(bool report=false);
 
     // IO Methods.
-    bool ExportJson(fs::path path);
-    bool ImportJson(fs::path path);
+    bool ExportJson(fs::path path, bool atomic=true);
+    bool ImportJson(fs::path path, bool validate=false);
+    bool ExportBinary(fs::path path, bool atomic=true);
+    bool ImportBinary(fs::path path, bool validate=false);
+
+private:
+    void Record(ChangeKind kind, JunctionID id, JunctionID other, Coord lo, Coord hi);
+    void ContinueFrom(Maze &other);
+    void Adopt(Maze &other);
+    bool Load(string mazeName, vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels,
+        vector<TagCoord> &tags, bool validate);
+    uint32_t NewTagList();
+    void InsertBucket(JunctionID id, Coord coord);
+    void EraseBucket(JunctionID id, Coord coord);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include <cstring>
+
+#include "maze_binary.h"
+#include "maze.h"
+#include "file_writer.h"
+
+//
+// MazeChecksum methods.
+//
+void MazeChecksum::Mix(uint64_t word)
+{
+    hash ^= word;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 29;
+}
+void MazeChecksum::Update(const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    length += n;
+
+    // Complete the word left over from the previous update first.
+    while (pendingBytes > 0 && n > 0) {
+        pending |= (uint64_t)*p++ << (8*pendingBytes++);
+        n--;
+        if (pendingBytes == 8) {
+            Mix(pending);
+            pending = 0;
+            pendingBytes = 0;
+        }
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        Mix(word);
+    }
+    for (; n > 0; n--) {
+        pending |= (uint64_t)*p++ << (8*pendingBytes++);
+    }
+}
+uint64_t MazeChecksum::Finish()
+{
+    if (pendingBytes > 0)
+        Mix(pending);
+    Mix(length);
+    return hash;
+}
+
+//
+// MazeBinaryView methods.
+//
+MazeBinaryView::MazeBinaryView()
+{
+}
+MazeBinaryView::~MazeBinaryView()
+{
+    Close();
+}
+bool MazeBinaryView::Open(fs::path path)
+{
+    Close();
+
+    if (!file.Open(path))
+        return false;
+    const char *data = file.data;
+    size_t size = file.size;
+    if (size < sizeof(MazeBinaryHeader)) {
+        Close();
+        return false;
+    }
+
+    // Check the header against the file before trusting any of it.
+    header = (const MazeBinaryHeader *)data;
+    const MazeBinaryHeader &h = *header;
+    uint64_t expected = sizeof(MazeBinaryHeader)
+        + (uint64_t)h.junctionCount * sizeof(MazeBinaryJunction)
+        + (uint64_t)h.tunnelCount * sizeof(MazeBinaryTunnel)
+        + (uint64_t)h.tagCoordCount * sizeof(MazeBinaryTags)
+        + (uint64_t)h.tagRefCount * sizeof(uint32_t)
+        + ((uint64_t)h.stringCount + 1) * sizeof(uint32_t)
+        + h.stringBytes;
+    if (h.magic != MAZE_BINARY_MAGIC || h.version != MAZE_BINARY_VERSION || expected != size) {
+        printf("Not a valid version %d binary maze\n", MAZE_BINARY_VERSION);
+        Close();
+        return false;
+    }
+
+    MazeChecksum sum;
+    sum.Update(data + sizeof(MazeBinaryHeader), size - sizeof(MazeBinaryHeader));
+    if (sum.Finish() != h.checksum) {
+        printf("Checksum mismatch in binary maze\n");
+        Close();
+        return false;
+    }
+
+    const char *p = data + sizeof(MazeBinaryHeader);
+    junctions = (const MazeBinaryJunction *)p;
+    p += h.junctionCount * sizeof(MazeBinaryJunction);
+    tunnels = (const MazeBinaryTunnel *)p;
+    p += h.tunnelCount * sizeof(MazeBinaryTunnel);
+    tags = (const MazeBinaryTags *)p;
+    p += h.tagCoordCount * sizeof(MazeBinaryTags);
+    tagRefs = (const uint32_t *)p;
+    p += h.tagRefCount * sizeof(uint32_t);
+    stringOffsets = (const uint32_t *)p;
+    p += (h.stringCount + 1) * sizeof(uint32_t);
+    stringData = p;
+
+    // Offsets must be ordered so every string lies inside the data.
+    for (uint32_t i = 0; i < h.stringCount; i++) {
+        if (stringOffsets[i] > stringOffsets[i+1]) {
+            Close();
+            return false;
+        }
+    }
+    if (stringOffsets[0] != 0 || stringOffsets[h.stringCount] != h.stringBytes) {
+        Close();
+        return false;
+    }
+    return true;
+}
+void MazeBinaryView::Close()
+{
+    file.Close();
+    header = nullptr;
+    junctions = nullptr;
+    tunnels = nullptr;
+    tags = nullptr;
+    tagRefs = nullptr;
+    stringOffsets = nullptr;
+    stringData = nullptr;
+}
+string_view MazeBinaryView::GetString(uint32_t index)
+{
+    if (header == nullptr || index >= header->stringCount)
+        return string_view();
+    return string_view(stringData + stringOffsets[index], stringOffsets[index+1] - stringOffsets[index]);
+}
+
+//
+// Maze binary IO methods.
+//
+bool Maze::ExportBinary(fs::path filePath, bool atomic)
+{
+    FileWriter out(filePath, atomic);
+    if (!out.IsOpen())
+        return false;
+
+    // Strings are numbered on first use, the table itself goes last.
+    unordered_map<string_view, uint32_t> stringIndex;
+    vector<string_view> strings;
+    uint64_t stringBytes = 0;
+    auto intern = [&](const string &s) {
+        auto it = stringIndex.find(s);
+        if (it != stringIndex.end())
+            return it->second;
+        uint32_t index = strings.size();
+        stringIndex[s] = index;
+        strings.push_back(s);
+        stringBytes += s.size();
+        return index;
+    };
+
+    // The header is written again at the end, when all counts are known.
+    MazeBinaryHeader header = {};
+    header.magic = MAZE_BINARY_MAGIC;
+    header.version = MAZE_BINARY_VERSION;
+    header.nameString = intern(name);
+    out.Write((const char *)&header, sizeof(header));
+
+    MazeChecksum sum;
+    auto put = [&](const void *data, size_t n) {
+        sum.Update(data, n);
+        out.Write((const char *)data, n);
+    };
+
+    for (auto &kv: id_to_junction) {
+        Junction &j = kv.second;
+        Coord c = GetJunctionCoord(j.id);
+        JunctionRect r = GetJunctionRect(j.id);
+        MazeBinaryJunction record = { j.id, intern(name_pool.Get(j.name)), c.x, c.y, r.top.x, r.top.y, r.bot.x, r.bot.y };
+        put(&record, sizeof(record));
+        header.junctionCount++;
+    }
+
+    for (auto &pair1: tunnel_map) {
+        for (auto &pair2: pair1.second) {
+            if (pair1.first < pair2.first) {
+                MazeBinaryTunnel record = { pair1.first, pair2.first };
+                put(&record, sizeof(record));
+                header.tunnelCount++;
+            }
+        }
+    }
+
+    vector<uint32_t> tagRefs;
+    coord_to_tags.ForEach([&](Coord c, uint32_t list) {
+        vector<TagID> &tags = tag_lists[list];
+        MazeBinaryTags record = { c.x, c.y, (uint32_t)tagRefs.size(), (uint32_t)tags.size() };
+        for (TagID tag: tags)
+            tagRefs.push_back(intern(tag_pool.Get(tag)));
+        put(&record, sizeof(record));
+        header.tagCoordCount++;
+    });
+    put(tagRefs.data(), tagRefs.size() * sizeof(uint32_t));
+    header.tagRefCount = tagRefs.size();
+
+    if (stringBytes > UINT32_MAX) {
+        printf("Too much string data for a binary maze\n");
+        return false;
+    }
+    uint32_t offset = 0;
+    for (string_view s: strings) {
+        put(&offset, sizeof(offset));
+        offset += s.size();
+    }
+    put(&offset, sizeof(offset));
+    for (string_view s: strings)
+        put(s.data(), s.size());
+    header.stringCount = strings.size();
+    header.stringBytes = stringBytes;
+
+    header.checksum = sum.Finish();
+    out.WriteAt(0, &header, sizeof(header));
+    if (!out.Close())
+        return false;
+
+    Log("Written maze \"%s\" to binary \"%s\"\n", name.c_str(), filePath.string().c_str());
+    return true;
+}
+bool Maze::ImportBinary(fs::path filePath, bool validate)
+{
+    MazeBinaryView view;
+    if (!view.Open(filePath))
+        return false;
+    const MazeBinaryHeader &h = *view.header;
+
+    vector<JunctionRecord> junctions(h.junctionCount);
+    for (uint32_t i = 0; i < h.junctionCount; i++) {
+        const MazeBinaryJunction &b = view.junctions[i];
+        JunctionRecord &r = junctions[i];
+        r.name = view.GetString(b.name);
+        r.id = b.id;
+        r.coord = Coord(b.x, b.y);
+        r.rect = JunctionRect(Coord(b.topX, b.topY), Coord(b.botX, b.botY));
+    }
+
+    vector<Tunnel> tunnels(h.tunnelCount);
+    for (uint32_t i = 0; i < h.tunnelCount; i++) {
+        tunnels[i] = { view.tunnels[i].from, view.tunnels[i].to };
+    }
+
+    vector<TagCoord> tags(h.tagCoordCount);
+    for (uint32_t i = 0; i < h.tagCoordCount; i++) {
+        const MazeBinaryTags &b = view.tags[i];
+        if ((uint64_t)b.first + b.count > h.tagRefCount)
+            return false;
+        tags[i].coord = Coord(b.x, b.y);
+        tags[i].tags.reserve(b.count);
+        for (uint32_t j = 0; j < b.count; j++)
+            tags[i].tags.emplace_back(view.GetString(view.tagRefs[b.first+j]));
+    }
+
+    return Load(string(view.GetString(h.nameString)), junctions, tunnels, tags, validate);
+}
@@ -0,0 +1,106 @@
+#ifndef MAZE_BINARY_H
+#define MAZE_BINARY_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include "mapped_file.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+// The binary maze format (.mzb) is laid out as:
+//   MazeBinaryHeader
+//   MazeBinaryJunction[junctionCount]
+//   MazeBinaryTunnel[tunnelCount]
+//   MazeBinaryTags[tagCoordCount]
+//   uint32_t tagRefs[tagRefCount]            string index per tag
+//   uint32_t stringOffsets[stringCount+1]    into the string data
+//   char stringData[stringBytes]
+// Every field is 4 byte aligned and in host (little endian) order, so the
+// records are used straight from a memory mapping. Strings are shared, a
+// name or tag that appears many times is stored once.
+#define MAZE_BINARY_MAGIC 0x42525a4d // "MZRB"
+#define MAZE_BINARY_VERSION 1
+
+struct MazeBinaryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t junctionCount;
+    uint32_t tunnelCount;
+    uint32_t tagCoordCount;
+    uint32_t tagRefCount;
+    uint32_t stringCount;
+    uint32_t nameString;
+    uint32_t stringBytes;
+    uint32_t reserved;
+    // Checksum of everything following the header.
+    uint64_t checksum;
+};
+
+struct MazeBinaryJunction {
+    uint32_t id;
+    uint32_t name;
+    int32_t x;
+    int32_t y;
+    int32_t topX;
+    int32_t topY;
+    int32_t botX;
+    int32_t botY;
+};
+
+struct MazeBinaryTunnel {
+    uint32_t from;
+    uint32_t to;
+};
+
+struct MazeBinaryTags {
+    int32_t x;
+    int32_t y;
+    uint32_t first;
+    uint32_t count;
+};
+
+// Streaming checksum over 64 bit words, cheap enough to run over every
+// load of a large maze.
+class MazeChecksum {
+private:
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t pending = 0;
+    int pendingBytes = 0;
+    uint64_t length = 0;
+
+    void Mix(uint64_t word);
+
+public:
+    void Update(const void *data, size_t n);
+    uint64_t Finish();
+};
+
+// Read-only view of a binary maze file. The file is memory mapped and all
+// pointers point into the mapping, nothing is copied or allocated per record.
+class MazeBinaryView {
+private:
+    MappedFile file;
+
+public:
+    const MazeBinaryHeader *header = nullptr;
+    const MazeBinaryJunction *junctions = nullptr;
+    const MazeBinaryTunnel *tunnels = nullptr;
+    const MazeBinaryTags *tags = nullptr;
+    const uint32_t *tagRefs = nullptr;
+    const uint32_t *stringOffsets = nullptr;
+    const char *stringData = nullptr;
+
+    MazeBinaryView();
+    MazeBinaryView(const MazeBinaryView &) = delete;
+    MazeBinaryView &operator=(const MazeBinaryView &) = delete;
+    ~MazeBinaryView();
+
+    bool Open(fs::path path);
+    void Close();
+    string_view GetString(uint32_t index);
+};
+
+#endif
@@ -6,6 +6,10 @@
 #include <vector>
 #include "arclib.h"
 #include "maze.h"
+#include "maze_graph.h"
+#include "maze_history.h"
+#include "maze_router.h"
+#include "generation_task.h"
 #include "file_dialog.h"
 #include "maze_renderer.h"
 
@@ -17,6 +21,9 @@ using namespace std;
 #define KEY_TUNNEL IsKeyPressed(KEY_F)
 #define KEY_EXPORT IsKeyPressed(KEY_X)
 #define KEY_PRUNE IsKeyPressed(KEY_P)
+#define KEY_UNDO IsKeyPressed(KEY_Z)
+#define KEY_REDO IsKeyPressed(KEY_Y)
+#define CTRLKEY IsKeyDown(KEY_LEFT_CONTROL)
 #define MODKEY IsKeyDown(KEY_LEFT_SHIFT)
 #define ALTKEY IsKeyDown(KEY_LEFT_ALT)
 
@@ -30,7 +37,12 @@ namespace Gui = ImGui;
 class MazeEditor {
 public:
     Maze maze;
+    // Every edit goes through the history, after the maze so it lets go
+    // of the maze before the maze is gone.
+    MazeHistory history;
     MazeRenderer mazeRenderer;
+    MazeGraph mazeGraph;
+    MazeRouter router;
     float tileSize = 16;
 
     FileDialog fileDialog;
@@ -52,6 +64,25 @@ public:
     bool hasSelectedCoord = false;
     JunctionID mainJunctionID = 0;
     JunctionID secondJunctionID = 0;
+    // Typing a name and dragging a corner merge into one undo step, each
+    // under its own merge key.
+    uint64_t mergeKeys = 0;
+    uint64_t nameKey = 0;
+    uint64_t dragKey = 0;
+    bool dragging = false;
+
+    vector<JunctionID> route;
+    uint32_t routeLength = ROUTE_INFINITY;
+    // The query the route answers, also when there is no route.
+    JunctionID routeFrom = 0;
+    JunctionID routeTo = 0;
+    uint64_t routeVersion = 0;
+
+    GenerationTask generation;
+    MazeGeneratorSettings generatorSettings;
+    int generatorAlgorithm = 0;
+    int generatorSeed = 1;
+    float generationBudget = 4;
 
     Vector2 topCornerWorld = {};
     Vector2 botCornerWorld = {};
@@ -66,6 +97,7 @@ public:
     char nameBuf[128] = "";
     char tagBuf[128] = "";
     char mazeNameBuf[128] = "";
+    char findBuf[128] = "";
     int tagsItem;
     vector<string> tagsList;
     bool mazeHasFocus = false;
@@ -79,9 +111,12 @@ public:
     bool showSectors = true;
     bool showIdMap = false;
     bool showTags = true;
+    bool showRoute = true;
 
     MazeEditor()
     {
+        // Edited mazes are dense around the view, keep their cells in chunks.
+        maze.SetGridBackend(GRID_CHUNKED);
         CenterHome();
         ColorToFloat3(mazeRenderer.junctionColor, junctionColorArr);
         ColorToFloat3(mazeRenderer.gridColor, gridColorArr);
@@ -90,6 +125,8 @@ public:
         ColorToFloat3(mazeRenderer.tunnelColor, tunnelColorArr);
         strcpy(mazeNameBuf, maze.name.c_str());
         mazeRenderer.SetMaze(&maze);
+        history.SetMaze(&maze);
+        router.SetGraph(&mazeGraph);
         LoadMaze("Examples/test.json");
     }
 
@@ -106,7 +143,9 @@ public:
         mouseJunction = maze.GetJunctionAt(mouseCoord.x, mouseCoord.y);
         mouseTunnel = maze.GetTunnelAt(mouseCoord.x, mouseCoord.y);
         mazeHasFocus = !Gui::GetIO().WantCaptureMouse;
+        generation.Step(maze, generationBudget / 1000.0);
         ConfigureMainJunction();
+        UpdateRoute();
         SetStatusBar();
 
         // Selection stuff only when mouse is in the maze area.
@@ -124,17 +163,44 @@ public:
         }
 
         // Creation / Deletion
-        if(ALTKEY && KEY_SELECT && mouseJunction == 0)      maze.AddJunction(mouseCoord.x, mouseCoord.y, "x");
-        if(ALTKEY && KEY_REMOVE && mouseJunction > 0)       maze.RemoveJunction(mouseJunction);
-        if(ALTKEY && KEY_REMOVE && mouseTunnel.from > 0)    maze.RemoveTunnel(mouseTunnel);
+        if(ALTKEY && KEY_SELECT && mouseJunction == 0)      history.AddJunction(mouseCoord.x, mouseCoord.y, "x");
+        if(ALTKEY && KEY_REMOVE && mouseJunction > 0)       history.RemoveJunction(mouseJunction);
+        if(ALTKEY && KEY_REMOVE && mouseTunnel.from > 0)    history.RemoveTunnel(mouseTunnel);
         if(KEY_TUNNEL && mainJunctionID > 0 && secondJunctionID > 0)  {
-            maze.AddTunnel(mainJunctionID, secondJunctionID);
+            history.AddTunnel(mainJunctionID, secondJunctionID);
             ClearSelections();
         }
 
         // Utility
         if(MODKEY && KEY_EXPORT)    maze.ExportJson("Mazes/test.json");
-        if(MODKEY && KEY_PRUNE)     maze.PruneJunctions();
+        if(MODKEY && KEY_PRUNE)     history.PruneJunctions();
+        if(CTRLKEY && KEY_UNDO && !MODKEY)                  Undo();
+        if(CTRLKEY && (KEY_REDO || MODKEY && KEY_UNDO))     Redo();
+    }
+    void Undo()
+    {
+        if (history.Undo())
+            RefreshSelections();
+    }
+    void Redo()
+    {
+        if (history.Redo())
+            RefreshSelections();
+    }
+    void RefreshSelections()
+    {
+        // Undo and redo change the maze under the selection. Reload the
+        // panel from the maze, or it would write its old values back.
+        if (secondJunctionID > 0 && !maze.JunctionExists(secondJunctionID))
+            secondJunctionID = 0;
+        if (mainJunctionID > 0 && !maze.JunctionExists(mainJunctionID)) {
+            ClearSelections();
+            return;
+        }
+        if (mainJunctionID > 0)
+            SetMainJunction(mainJunctionID);
+        if (hasSelectedCoord)
+            SelectCoord(selectedCoord);
     }
     void SetStatusBar()
     {
@@ -170,7 +236,49 @@ public:
             if (s.size() == 0)
                 tagsList.erase(tagsList.begin()+i);
         }
-        maze.SetTagsAt(selectedCoord.x, selectedCoord.y, tagsList);
+        history.SetTagsAt(selectedCoord.x, selectedCoord.y, tagsList);
+    }
+    void UpdateRoute()
+    {
+        // Route between the two selected junctions, redone after edits.
+        if (!showRoute || mainJunctionID == 0 || secondJunctionID == 0) {
+            route.clear();
+            routeFrom = routeTo = 0;
+            return;
+        }
+        if (routeFrom == mainJunctionID && routeTo == secondJunctionID && routeVersion == maze.version)
+            return;
+
+        if (mazeGraph.IsStale(maze)) {
+            mazeGraph = MazeGraph(maze);
+            router.SetGraph(&mazeGraph);
+        }
+        routeLength = router.FindPath(mainJunctionID, secondJunctionID, route);
+        routeFrom = mainJunctionID;
+        routeTo = secondJunctionID;
+        routeVersion = maze.version;
+    }
+    void StartGeneration()
+    {
+        // The region starts at the selection. Two selected junctions span
+        // the region between them instead of the configured size.
+        MazeGeneratorSettings settings = generatorSettings;
+        settings.algorithm = (MazeAlgorithm)generatorAlgorithm;
+        settings.seed = generatorSeed;
+        if (mainJunctionID > 0 && secondJunctionID > 0) {
+            Coord a = maze.GetJunctionCoord(mainJunctionID);
+            Coord b = maze.GetJunctionCoord(secondJunctionID);
+            settings.origin = { min(a.x, b.x), min(a.y, b.y) };
+            settings.width = abs(a.x - b.x) / settings.spacing + 1;
+            settings.height = abs(a.y - b.y) / settings.spacing + 1;
+        } else if (mainJunctionID > 0) {
+            settings.origin = maze.GetJunctionCoord(mainJunctionID);
+        } else if (hasSelectedCoord) {
+            settings.origin = selectedCoord;
+        } else {
+            settings.origin = mouseCoord;
+        }
+        generation.Start(maze, settings);
     }
     void ConfigureMainJunction() 
     {
@@ -178,14 +286,24 @@ public:
             return;
         // Transfer all GUI parameters to the selected junction.
         // It is essentially "docked" at the GUI and the GUI unloads its cargo.
-        Junction &j = maze.GetJunction(mainJunctionID);
-        j.name = string(nameBuf);
+        JunctionID id = mainJunctionID;
+        history.mergeKey = nameKey;
+        history.RenameJunction(id, string(nameBuf));
 
-        Coord coords = maze.GetJunctionCoord(j.id);
+        // A drag starts when a corner is grabbed.
+        bool grabbed = topCornerGrabbed || botCornerGrabbed;
+        if (grabbed && !dragging)
+            dragKey = ++mergeKeys;
+        dragging = grabbed;
+        history.mergeKey = dragging ? dragKey : 0;
+
+        Coord coords = maze.GetJunctionCoord(id);
         topCorner =  { (int)floorf(topCornerWorld.x/tileSize+0.5)-coords.x, (int)floorf(topCornerWorld.y/tileSize+0.5)-coords.y };
         botCorner =  { (int)floorf(botCornerWorld.x/tileSize+0.5)-coords.x, (int)floorf(botCornerWorld.y/tileSize+0.5)-coords.y };
-        if (!maze.SetJunctionRect(j.id, JunctionRect(topCorner, botCorner))) {
-            JunctionRect r = maze.GetJunctionRect(j.id);
+        bool set = history.SetJunctionRect(id, JunctionRect(topCorner, botCorner));
+        history.mergeKey = 0;
+        if (!set) {
+            JunctionRect r = maze.GetJunctionRect(id);
             topCornerWorld = {  (r.top.x+coords.x) * tileSize, (r.top.y+coords.y) * tileSize };
             botCornerWorld = {  (r.bot.x+coords.x) * tileSize, (r.bot.y+coords.y) * tileSize };
         }
@@ -197,8 +315,9 @@ public:
     void SetMainJunction(JunctionID id)
     {
         mainJunctionID = id;
+        nameKey = ++mergeKeys;
         Junction &j = maze.GetJunction(id);
-        strncpy(nameBuf, j.name.c_str(), 128);
+        strncpy(nameBuf, maze.GetJunctionName(id).c_str(), 128);
 
         Coord coords = maze.GetJunctionCoord(id);
         JunctionRect r = maze.GetJunctionRect(j.id);
@@ -212,7 +331,7 @@ public:
     }
     void SelectCoord(Coord coord)
     {
-        tagsList = maze.GetTagsAt(coord.x, coord.y);
+        tagsList = maze.GetTagNamesAt(coord.x, coord.y);
         selectedCoord = coord;
         hasSelectedCoord = true;
     }
@@ -240,21 +359,29 @@ public:
             if (homeId > 0)
                 break;
         }
-        if (homeId > 0) {
-            float tileSize = mazeRenderer.tileSize;
-            Coord homeCoord = maze.GetJunctionCoord(homeId);
-            arcGlobal.camera.target = { (float)homeCoord.x * tileSize, (float)homeCoord.y * tileSize };
-            arcGlobal.camera.offset.x = GetScreenWidth() / 2;
-            arcGlobal.camera.offset.y = GetScreenHeight() / 2;
-        }
+        if (homeId > 0)
+            CenterJunction(homeId);
+    }
+    void CenterJunction(JunctionID id)
+    {
+        float tileSize = mazeRenderer.tileSize;
+        Coord coord = maze.GetJunctionCoord(id);
+        arcGlobal.camera.target = { (float)coord.x * tileSize, (float)coord.y * tileSize };
+        arcGlobal.camera.offset.x = GetScreenWidth() / 2;
+        arcGlobal.camera.offset.y = GetScreenHeight() / 2;
     }
     
     //
     // IO Methods.
     //
+    bool IsBinaryPath(fs::path path)
+    {
+        return path.extension() == ".mzb";
+    }
     void SaveMaze(fs::path path)
     {
-        if (maze.ExportJson(path)) {
+        bool saved = IsBinaryPath(path) ? maze.ExportBinary(path) : maze.ExportJson(path);
+        if (saved) {
             filePath = path;
             cout << "Saved " << filePath << endl;
         } else {
@@ -263,16 +390,27 @@ public:
     }
     void LoadMaze(fs::path path)
     {
-        if (maze.ImportJson(path)) {
+        // A file that does not load or has conflicts leaves the open maze
+        // and its path as they were, so saving cannot overwrite the file
+        // with something else.
+        bool loaded = false;
+        try {
+            loaded = IsBinaryPath(path) ? maze.ImportBinary(path, true) : maze.ImportJson(path, true);
+        } catch (exception &e) {
+            cout << e.what() << endl;
+        }
+        if (loaded) {
             filePath = path;
+            strncpy(mazeNameBuf, maze.name.c_str(), IM_ARRAYSIZE(mazeNameBuf)-1);
+            ClearSelections();
             cout << "Loaded " << filePath << endl;
         } else {
-            cout << "Invalid file " << filePath << endl;
+            cout << "Invalid file " << path << ", kept " << filePath << endl;
         }
     }
     void NewMaze()
     {
-        maze = Maze();
+        maze.Erase();
         filePath = "";
         cout << "New Maze" << endl;
     }
@@ -293,6 +431,7 @@ public:
         if (showGrid) mazeRenderer.DrawGrid();
         mazeRenderer.DrawTunnels();
         if (showJunctions) mazeRenderer.DrawJunctions();
+        if (showRoute) DrawRoute();
         DrawSelectionHighlight();
 
         // Junction corner gizmos.
@@ -317,6 +456,7 @@ public:
         DrawGuiMenuBar();
         DrawGuiEditorSettings();
         DrawGuiMazeSettings();
+        DrawGuiGenerator();
         DrawGuiInspector();
         if (fileDialog.Update()) {
             if (loadOnFile) {
@@ -338,6 +478,17 @@ public:
         };
         DrawRectangleLinesZ(rect, 0.5, WHITE, 3*fabsf(sin(GetTime()*8)));
     }
+    void DrawRoute()
+    {
+        float tileSize = mazeRenderer.tileSize;
+        for (int i = 0; i+1 < route.size(); i++) {
+            Coord c1 = maze.GetJunctionCoord(route[i]);
+            Coord c2 = maze.GetJunctionCoord(route[i+1]);
+            Vector2 pos1 = Vector2Scale({ c1.x+0.5f, c1.y+0.5f }, tileSize);
+            Vector2 pos2 = Vector2Scale({ c2.x+0.5f, c2.y+0.5f }, tileSize);
+            DrawLineZ(pos1, pos2, YELLOW, mazeRenderer.tunnelSize/2.0f, 0.5);
+        }
+    }
     void DrawSelectionHighlight()
     {
         if (mainJunctionID > 0) {
@@ -387,6 +538,7 @@ public:
                 Gui::TableNextColumn(); Gui::Checkbox("Sectors", &showSectors);
                 Gui::TableNextColumn(); Gui::Checkbox("Tunnel Labels", &showTunnelLabels);
                 Gui::TableNextColumn(); Gui::Checkbox("ID map", &showIdMap);
+                Gui::TableNextColumn(); Gui::Checkbox("Route", &showRoute);
                 Gui::EndTable();
             }
             
@@ -394,6 +546,57 @@ public:
             Gui::Spacing();
         }
     }
+    void DrawGuiGenerator()
+    {
+        if (Gui::TreeNode("Generator")) {
+            Gui::Combo("Algorithm", &generatorAlgorithm, "Backtracker\0Kruskal\0Wilson\0");
+            Gui::InputInt("Seed", &generatorSeed);
+            Gui::InputInt("Width", &generatorSettings.width);
+            Gui::InputInt("Height", &generatorSettings.height);
+            Gui::SliderInt("Spacing", &generatorSettings.spacing, 2, 16);
+            Gui::SliderFloat("Loops", &generatorSettings.loops, 0, 0.5);
+            Gui::SliderFloat("Budget (ms)", &generationBudget, 1, 16);
+            generatorSettings.width = max(generatorSettings.width, 1);
+            generatorSettings.height = max(generatorSettings.height, 1);
+
+            if (!generation.IsRunning()) {
+                if (Gui::Button("Generate"))
+                    StartGeneration();
+                Gui::SameLine();
+                Gui::TextDisabled("at the selection");
+            } else {
+                Gui::ProgressBar(generation.GetProgress(), ImVec2(-1, 0));
+                if (Gui::Button(generation.paused ? "Resume" : "Pause"))
+                    generation.paused = !generation.paused;
+                Gui::SameLine();
+                if (Gui::Button("Cancel"))
+                    generation.Cancel();
+                Gui::SameLine();
+                Gui::Text("%zu junctions, %zu skipped", generation.added, generation.skipped);
+            }
+            Gui::TreePop();
+            Gui::Spacing();
+        }
+    }
+    void DrawGuiFindJunction()
+    {
+        // Autocomplete on the name index, a click jumps to the junction.
+        Gui::InputText("Find", findBuf, IM_ARRAYSIZE(findBuf));
+        if (findBuf[0] == '\0')
+            return;
+        vector<JunctionID> matches = maze.FindJunctionsByPrefix(findBuf, 8);
+        for (JunctionID id: matches) {
+            if (Gui::Selectable(TextFormat("%s (%u)", maze.GetJunctionName(id).c_str(), id))) {
+                ClearSelections();
+                SetMainJunction(id);
+                SelectCoord(maze.GetJunctionCoord(id));
+                CenterJunction(id);
+                findBuf[0] = '\0';
+            }
+        }
+        if (matches.size() == 0)
+            Gui::TextDisabled("No junction named %s...", findBuf);
+    }
     void DrawGuiInspector()
     {
         if (Gui::TreeNode("Inspector")){
@@ -407,8 +610,15 @@ public:
                 Gui::BulletText("Select non-junction with ");
                 Gui::SameLine(); Gui::TextColored(ImVec4(0, 1, 0, 1), "Shift+LMB");
             }
+            DrawGuiFindJunction();
             if (mainJunctionID > 0) 
                 Gui::InputText("Junction Name", nameBuf, IM_ARRAYSIZE(nameBuf));
+            if (mainJunctionID > 0 && secondJunctionID > 0 && showRoute) {
+                if (routeLength != ROUTE_INFINITY)
+                    Gui::Text("Route length %u over %d junctions", routeLength, (int)route.size());
+                else
+                    Gui::Text("No route between the junctions");
+            }
             // The two buttons.
             if (hasSelectedCoord) {
                 Gui::Text("Tag Position (%d, %d)", selectedCoord.x, selectedCoord.y);
@@ -460,6 +670,15 @@ public:
                 }
                 Gui::EndMenu();
             }
+            if (Gui::BeginMenu("Edit")) {
+                if (Gui::MenuItem("Undo", "Ctrl+Z", false, history.CanUndo()))
+                    Undo();
+                if (Gui::MenuItem("Redo", "Ctrl+Y", false, history.CanRedo()))
+                    Redo();
+                Gui::Separator();
+                Gui::TextDisabled("History %.1f MB", history.GetMemory() / 1e6);
+                Gui::EndMenu();
+            }
             Gui::PushStyleColor(ImGuiCol_Text, ImVec4(0.3, 0.3, 0.3, 1));    
             Gui::Text(statusBarText.c_str());
             Gui::PopStyleColor();
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <numeric>
+#include <thread>
+#include "maze_generator.h"
+
+// Bits of the open array, the tunnel to the right and the one below.
+#define OPEN_RIGHT 1
+#define OPEN_DOWN 2
+
+//
+// MazeRandom methods.
+//
+MazeRandom::MazeRandom(uint64_t seed)
+: state(seed)
+{
+}
+uint64_t MazeRandom::Next()
+{
+    // SplitMix64.
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+uint32_t MazeRandom::Below(uint32_t n)
+{
+    return (uint32_t)(((Next() >> 32) * n) >> 32);
+}
+double MazeRandom::Unit()
+{
+    return (Next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//
+// MazeGenerator methods.
+//
+MazeGenerator::MazeGenerator()
+: MazeGenerator(MazeGeneratorSettings())
+{
+}
+MazeGenerator::MazeGenerator(MazeGeneratorSettings _settings)
+: settings(_settings)
+{
+    settings.width = max(settings.width, 1);
+    settings.height = max(settings.height, 1);
+    settings.spacing = max(settings.spacing, 2);
+    settings.tileSize = max(settings.tileSize, 2);
+    tilesX = (settings.width + settings.tileSize - 1) / settings.tileSize;
+    tilesY = (settings.height + settings.tileSize - 1) / settings.tileSize;
+}
+
+MazeGeneratorSettings &MazeGenerator::GetSettings()
+{
+    return settings;
+}
+
+JunctionID MazeGenerator::GetID(int x, int y)
+{
+    return settings.idBase + y*settings.width + x;
+}
+
+void MazeGenerator::Carve(MazeRandom &rng, int w, int h, vector<uint8_t> &open)
+{
+    // Carves a spanning tree of a w by h grid into the open bits.
+    int n = w*h;
+    auto connect = [&](int a, int b) {
+        if (a > b)
+            swap(a, b);
+        open[a] |= b == a+w ? OPEN_DOWN : OPEN_RIGHT;
+    };
+    auto neighbors = [&](int cell, int out[4]) {
+        int x = cell % w, y = cell / w, count = 0;
+        if (x > 0) out[count++] = cell-1;
+        if (x+1 < w) out[count++] = cell+1;
+        if (y > 0) out[count++] = cell-w;
+        if (y+1 < h) out[count++] = cell+w;
+        return count;
+    };
+
+    if (settings.algorithm == MAZE_BACKTRACKER) {
+        // Depth first walk that backs up at dead ends, long winding tunnels.
+        vector<char> visited(n, 0);
+        vector<int> stack = { (int)rng.Below(n) };
+        visited[stack[0]] = 1;
+        while (stack.size() > 0) {
+            int cell = stack.back();
+            int next[4], count = 0, all[4];
+            int total = neighbors(cell, all);
+            for (int i = 0; i < total; i++) {
+                if (!visited[all[i]])
+                    next[count++] = all[i];
+            }
+            if (count == 0) {
+                stack.pop_back();
+                continue;
+            }
+            int pick = next[rng.Below(count)];
+            connect(cell, pick);
+            visited[pick] = 1;
+            stack.push_back(pick);
+        }
+    } else if (settings.algorithm == MAZE_KRUSKAL) {
+        // Random edge order joined by union-find, many short dead ends.
+        vector<pair<int, int>> edges;
+        edges.reserve(2*n);
+        for (int cell = 0; cell < n; cell++) {
+            if (cell % w + 1 < w)
+                edges.push_back({ cell, cell+1 });
+            if (cell / w + 1 < h)
+                edges.push_back({ cell, cell+w });
+        }
+        for (int i = (int)edges.size()-1; i > 0; i--)
+            swap(edges[i], edges[rng.Below(i+1)]);
+        vector<int> root(n);
+        iota(root.begin(), root.end(), 0);
+        auto find = [&](int a) {
+            while (root[a] != a)
+                a = root[a] = root[root[a]];
+            return a;
+        };
+        for (auto &e: edges) {
+            int a = find(e.first), b = find(e.second);
+            if (a == b)
+                continue;
+            root[a] = b;
+            connect(e.first, e.second);
+        }
+    } else {
+        // Wilson: loop erased random walks, an unbiased spanning tree.
+        vector<char> inTree(n, 0);
+        vector<int> next(n, -1);
+        inTree[rng.Below(n)] = 1;
+        for (int start = 0; start < n; start++) {
+            int all[4];
+            for (int cell = start; !inTree[cell]; cell = next[cell])
+                next[cell] = all[rng.Below(neighbors(cell, all))];
+            for (int cell = start; !inTree[cell]; cell = next[cell]) {
+                inTree[cell] = 1;
+                connect(cell, next[cell]);
+            }
+        }
+    }
+
+    if (settings.loops > 0) {
+        for (int cell = 0; cell < n; cell++) {
+            if (cell % w + 1 < w && rng.Unit() < settings.loops)
+                open[cell] |= OPEN_RIGHT;
+            if (cell / w + 1 < h && rng.Unit() < settings.loops)
+                open[cell] |= OPEN_DOWN;
+        }
+    }
+}
+
+int MazeGenerator::TileCount()
+{
+    return tilesX*tilesY;
+}
+
+void MazeGenerator::GenerateTile(int tile, vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels)
+{
+    int x0 = (tile % tilesX) * settings.tileSize;
+    int y0 = (tile / tilesX) * settings.tileSize;
+    int w = min(settings.tileSize, settings.width - x0);
+    int h = min(settings.tileSize, settings.height - y0);
+
+    MazeRandom rng(settings.seed ^ ((uint64_t)(tile+1) * 0xd1b54a32d192ed03ULL));
+    rng.Next();
+    vector<uint8_t> open(w*h, 0);
+    Carve(rng, w, h, open);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            JunctionRecord r;
+            r.id = GetID(x0+x, y0+y);
+            r.coord = settings.origin + Coord((x0+x)*settings.spacing, (y0+y)*settings.spacing);
+            r.rect = { { 0, 0 }, { 1, 1 } };
+            junctions.push_back(r);
+
+            uint8_t bits = open[y*w + x];
+            if (bits & OPEN_RIGHT)
+                tunnels.push_back({ r.id, GetID(x0+x+1, y0+y) });
+            if (bits & OPEN_DOWN)
+                tunnels.push_back({ r.id, GetID(x0+x, y0+y+1) });
+        }
+    }
+}
+
+void MazeGenerator::GenerateStitches(vector<Tunnel> &tunnels)
+{
+    // Border k < horizontal joins tile k to its right neighbor, the rest
+    // join a tile to the one below.
+    int tileCount = TileCount();
+    int horizontal = (tilesX-1)*tilesY;
+    vector<int> borders((tilesX-1)*tilesY + tilesX*(tilesY-1));
+    iota(borders.begin(), borders.end(), 0);
+    MazeRandom rng(settings.seed ^ 0x5851f42d4c957f2dULL);
+    rng.Next();
+    for (int i = (int)borders.size()-1; i > 0; i--)
+        swap(borders[i], borders[rng.Below(i+1)]);
+
+    vector<int> root(tileCount);
+    iota(root.begin(), root.end(), 0);
+    auto find = [&](int a) {
+        while (root[a] != a)
+            a = root[a] = root[root[a]];
+        return a;
+    };
+    int size = settings.tileSize;
+    for (int border: borders) {
+        bool right = border < horizontal;
+        int tx = right ? border % (tilesX-1) : (border - horizontal) % tilesX;
+        int ty = right ? border / (tilesX-1) : (border - horizontal) / tilesX;
+        int a = ty*tilesX + tx;
+        int b = right ? a+1 : a+tilesX;
+
+        // Cells along the border, the last tile in a row may be short.
+        int length = right ? min(size, settings.height - ty*size) : min(size, settings.width - tx*size);
+        bool joined = find(a) != find(b);
+        if (joined)
+            root[find(a)] = find(b);
+        int pick = rng.Below(length);
+        for (int i = 0; i < length; i++) {
+            if (i != pick || !joined) {
+                if (settings.loops <= 0 || rng.Unit() >= settings.loops)
+                    continue;
+            }
+            int x = right ? (tx+1)*size - 1 : tx*size + i;
+            int y = right ? ty*size + i : (ty+1)*size - 1;
+            tunnels.push_back({ GetID(x, y), right ? GetID(x+1, y) : GetID(x, y+1) });
+        }
+    }
+}
+
+void MazeGenerator::Generate(vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels)
+{
+    int tileCount = TileCount();
+    vector<vector<JunctionRecord>> tileJunctions(tileCount);
+    vector<vector<Tunnel>> tileTunnels(tileCount);
+    atomic<int> next = 0;
+    auto work = [&]() {
+        for (int tile = next++; tile < tileCount; tile = next++)
+            GenerateTile(tile, tileJunctions[tile], tileTunnels[tile]);
+    };
+    int threads = settings.threads > 0 ? settings.threads : max(1u, thread::hardware_concurrency());
+    vector<thread> workers;
+    for (int i = 1; i < min(threads, tileCount); i++)
+        workers.emplace_back(work);
+    work();
+    for (thread &t: workers)
+        t.join();
+
+    // Join in tile order so the output does not depend on the scheduling.
+    size_t junctionCount = 0, tunnelCount = 0;
+    for (int tile = 0; tile < tileCount; tile++) {
+        junctionCount += tileJunctions[tile].size();
+        tunnelCount += tileTunnels[tile].size();
+    }
+    junctions.reserve(junctions.size() + junctionCount);
+    tunnels.reserve(tunnels.size() + tunnelCount + tileCount);
+    for (int tile = 0; tile < tileCount; tile++) {
+        move(tileJunctions[tile].begin(), tileJunctions[tile].end(), back_inserter(junctions));
+        tunnels.insert(tunnels.end(), tileTunnels[tile].begin(), tileTunnels[tile].end());
+        vector<JunctionRecord>().swap(tileJunctions[tile]);
+        vector<Tunnel>().swap(tileTunnels[tile]);
+    }
+    GenerateStitches(tunnels);
+}
+
+bool MazeGenerator::Prepare(Maze &maze)
+{
+    if (settings.idBase == 0) {
+        JunctionID top = 0;
+        for (auto &it: maze.id_to_junction)
+            top = max(top, it.first);
+        settings.idBase = top + 1;
+    }
+    if ((uint64_t)settings.idBase + (uint64_t)settings.width*settings.height > UINT32_MAX) {
+        printf("Not enough junction ids left for a %dx%d maze\n", settings.width, settings.height);
+        return false;
+    }
+    return true;
+}
+
+bool MazeGenerator::Generate(Maze &maze)
+{
+    if (!Prepare(maze))
+        return false;
+
+    // Bulk loading skips the checks, so look for occupied cells first,
+    // the grid points and then every cell the tunnels run through.
+    bool check = maze.id_to_junction.size() > 0;
+    auto taken = [&](Coord c) {
+        if (maze.GetJunctionAt(c.x, c.y) == 0 && maze.GetTunnelAt(c.x, c.y).from == 0)
+            return false;
+        printf("Cell (%d, %d) of the generated maze is taken\n", c.x, c.y);
+        return true;
+    };
+    for (int y = 0; y < settings.height && check; y++) {
+        for (int x = 0; x < settings.width; x++) {
+            if (taken(settings.origin + Coord(x*settings.spacing, y*settings.spacing)))
+                return false;
+        }
+    }
+
+    vector<JunctionRecord> junctions;
+    vector<Tunnel> tunnels;
+    vector<TagCoord> tags;
+    Generate(junctions, tunnels);
+    for (size_t i = 0; i < tunnels.size() && check; i++) {
+        uint32_t a = min(tunnels[i].from, tunnels[i].to) - settings.idBase;
+        uint32_t b = max(tunnels[i].from, tunnels[i].to) - settings.idBase;
+        Coord from = settings.origin + Coord((a % settings.width)*settings.spacing, (a / settings.width)*settings.spacing);
+        Coord step = b - a == (uint32_t)settings.width ? Coord(0, 1) : Coord(1, 0);
+        for (int k = 1; k < settings.spacing; k++) {
+            if (taken(from + Coord(step.x*k, step.y*k)))
+                return false;
+        }
+    }
+    maze.BulkInsert(junctions, tunnels, tags);
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef MAZE_GENERATOR_H
+#define MAZE_GENERATOR_H
+
+#include <cstdint>
+#include <vector>
+#include "maze.h"
+
+using namespace std;
+
+enum MazeAlgorithm {
+    MAZE_BACKTRACKER,
+    MAZE_KRUSKAL,
+    MAZE_WILSON,
+};
+
+// Small, fast generator with a fixed output for a given seed on every
+// platform, unlike the standard distributions.
+struct MazeRandom {
+    uint64_t state;
+
+    MazeRandom(uint64_t seed);
+    uint64_t Next();
+    uint32_t Below(uint32_t n);
+    double Unit();
+};
+
+struct MazeGeneratorSettings {
+    MazeAlgorithm algorithm = MAZE_BACKTRACKER;
+    uint64_t seed = 0;
+    // Size of the junction grid.
+    int width = 16;
+    int height = 16;
+    // Cells between neighboring junctions, at least 2.
+    int spacing = 4;
+    Coord origin = Coord(0, 0);
+    // Chance to open a tunnel that is not needed to connect the maze.
+    float loops = 0;
+    // Junction ids are idBase + y*width + x. Zero picks the first free
+    // block above the ids already in the maze.
+    JunctionID idBase = 0;
+    int tileSize = 128;
+    int threads = 0;
+};
+
+// Grid maze generator. The grid is cut into tiles which are carved on
+// their own, each from a seed derived from the maze seed, so tiles run in
+// parallel and the same seed gives the same maze on any thread count. The
+// tiles are then stitched together by a spanning tree over the tiles,
+// opening one tunnel across each chosen border.
+class MazeGenerator {
+private:
+    MazeGeneratorSettings settings;
+    int tilesX;
+    int tilesY;
+
+    JunctionID GetID(int x, int y);
+    void Carve(MazeRandom &rng, int w, int h, vector<uint8_t> &open);
+
+public:
+    MazeGenerator();
+    MazeGenerator(MazeGeneratorSettings settings);
+    MazeGeneratorSettings &GetSettings();
+
+    int TileCount();
+    // Junctions and the tunnels inside one tile.
+    void GenerateTile(int tile, vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels);
+    // Tunnels between the tiles, add them once every tile is in.
+    void GenerateStitches(vector<Tunnel> &tunnels);
+    void Generate(vector<JunctionRecord> &junctions, vector<Tunnel> &tunnels);
+
+    // Picks the junction ids for generating into the maze.
+    bool Prepare(Maze &maze);
+    // Generates straight into the maze. The grid must land on free cells.
+    bool Generate(Maze &maze);
+};
+
+#endif
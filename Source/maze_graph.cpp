@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cstdlib>
+#include "maze_graph.h"
+
+MazeGraph::MazeGraph()
+{
+    offsets.push_back(0);
+}
+MazeGraph::MazeGraph(Maze &maze)
+{
+    version = maze.version;
+
+    // Sorted IDs keep the indices the same for the same maze.
+    ids.reserve(maze.id_to_junction.size());
+    for (auto &kv: maze.id_to_junction)
+        ids.push_back(kv.first);
+    sort(ids.begin(), ids.end());
+
+    indices.reserve(ids.size());
+    coords.reserve(ids.size());
+    for (uint32_t i = 0; i < ids.size(); i++) {
+        indices[ids[i]] = i;
+        coords.push_back(maze.GetJunctionCoord(ids[i]));
+    }
+
+    // Tunnels to junctions that do not exist are left out.
+    offsets.reserve(ids.size() + 1);
+    offsets.push_back(0);
+    for (uint32_t i = 0; i < ids.size(); i++) {
+        uint32_t start = neighbors.size();
+        auto it = maze.tunnel_map.find(ids[i]);
+        if (it != maze.tunnel_map.end()) {
+            for (auto &kv: it->second) {
+                uint32_t index = GetIndex(kv.first);
+                if (index != GRAPH_NONE)
+                    neighbors.push_back(index);
+            }
+        }
+        sort(neighbors.begin() + start, neighbors.end());
+        for (uint32_t k = start; k < neighbors.size(); k++) {
+            Coord a = coords[i];
+            Coord b = coords[neighbors[k]];
+            lengths.push_back(abs(a.x - b.x) + abs(a.y - b.y));
+        }
+        offsets.push_back(neighbors.size());
+    }
+}
+
+bool MazeGraph::IsStale(Maze &maze)
+{
+    // Tags and names are not in the graph, edits to them only move the
+    // version along.
+    vector<MazeChange> changes;
+    if (!maze.GetChanges(version, changes))
+        return true;
+    for (MazeChange &change: changes) {
+        if (change.kind != CHANGE_SET_TAGS && change.kind != CHANGE_RENAME_JUNCTION)
+            return true;
+    }
+    version = maze.version;
+    return false;
+}
+uint32_t MazeGraph::Size()
+{
+    return ids.size();
+}
+uint32_t MazeGraph::GetIndex(JunctionID id)
+{
+    auto it = indices.find(id);
+    if (it != indices.end())
+        return it->second;
+    return GRAPH_NONE;
+}
+uint32_t MazeGraph::Degree(uint32_t index)
+{
+    return offsets[index+1] - offsets[index];
+}
@@ -0,0 +1,38 @@
+#ifndef MAZE_GRAPH_H
+#define MAZE_GRAPH_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "maze.h"
+
+using namespace std;
+
+#define GRAPH_NONE UINT32_MAX
+
+// Frozen compressed sparse row snapshot of the tunnel graph of a maze.
+// Junctions get dense indices 0..n-1 in ascending ID order. The neighbors
+// of junction i are neighbors[offsets[i]] up to neighbors[offsets[i+1]],
+// with the tunnel length of each in the same slot of lengths.
+// The snapshot does not follow edits, IsStale() checks the maze journal
+// for edits to junctions and tunnels since its version.
+class MazeGraph {
+public:
+    uint64_t version = 0;
+    vector<JunctionID> ids;
+    vector<Coord> coords;
+    vector<uint32_t> offsets;
+    vector<uint32_t> neighbors;
+    vector<uint32_t> lengths;
+    unordered_map<JunctionID, uint32_t> indices;
+
+    MazeGraph();
+    MazeGraph(Maze &maze);
+
+    bool IsStale(Maze &maze);
+    uint32_t Size();
+    uint32_t GetIndex(JunctionID id);
+    uint32_t Degree(uint32_t index);
+};
+
+#endif
@@ -0,0 +1,322 @@
+#include "maze_history.h"
+
+static size_t CommandMemory(EditCommand &command)
+{
+    return sizeof(EditCommand) + command.steps.capacity() * sizeof(EditStep) +
+        command.tags.capacity() * sizeof(TagID);
+}
+
+MazeHistory::MazeHistory()
+{
+}
+MazeHistory::~MazeHistory()
+{
+    SetMaze(nullptr);
+}
+void MazeHistory::SetMaze(Maze *_maze)
+{
+    if (maze != nullptr)
+        maze->Unsubscribe(subscriber);
+    Clear();
+    maze = _maze;
+    if (maze != nullptr)
+        subscriber = maze->Subscribe([this](const MazeChange &change) { OnChange(change); });
+}
+void MazeHistory::Clear()
+{
+    undos.clear();
+    redos.clear();
+    memory = 0;
+    merging = false;
+}
+bool MazeHistory::CanUndo()
+{
+    return undos.size() > 0;
+}
+bool MazeHistory::CanRedo()
+{
+    return redos.size() > 0;
+}
+bool MazeHistory::Undo()
+{
+    if (undos.empty())
+        return false;
+    Apply(undos.back(), true);
+    redos.push_back(move(undos.back()));
+    undos.pop_back();
+    merging = false;
+    return true;
+}
+bool MazeHistory::Redo()
+{
+    if (redos.empty())
+        return false;
+    Apply(redos.back(), false);
+    undos.push_back(move(redos.back()));
+    redos.pop_back();
+    merging = false;
+    return true;
+}
+size_t MazeHistory::GetMemory()
+{
+    return memory;
+}
+
+//
+// Edit methods.
+//
+void MazeHistory::AddJunction(int x, int y, string name)
+{
+    // The junction and any tunnel it splits come in from the journal.
+    Begin();
+    maze->AddJunction(x, y, name);
+    End();
+}
+void MazeHistory::RemoveJunction(JunctionID id)
+{
+    if (!maze->JunctionExists(id))
+        return;
+    Begin();
+    EditStep step = {};
+    step.kind = CHANGE_REMOVE_JUNCTION;
+    step.id = id;
+    step.value = maze->GetJunction(id).name;
+    step.coord = maze->GetJunctionCoord(id);
+    step.rect = maze->GetJunctionRect(id);
+    maze->RemoveJunction(id);
+
+    // After the tunnels it took along, so undo puts it back first.
+    command.steps.push_back(step);
+    End();
+}
+bool MazeHistory::RenameJunction(JunctionID id, string name)
+{
+    if (!maze->JunctionExists(id))
+        return false;
+    Begin();
+    EditStep step = {};
+    step.kind = CHANGE_RENAME_JUNCTION;
+    step.id = id;
+    step.other = maze->GetJunction(id).name;
+    uint64_t version = maze->version;
+    bool renamed = maze->RenameJunction(id, name);
+    if (maze->version != version) {
+        step.value = maze->GetJunction(id).name;
+        command.steps.push_back(step);
+    }
+    End();
+    return renamed;
+}
+bool MazeHistory::SetJunctionRect(JunctionID id, JunctionRect rect)
+{
+    if (!maze->JunctionExists(id))
+        return false;
+    Begin();
+    EditStep step = {};
+    step.kind = CHANGE_SET_RECT;
+    step.id = id;
+    step.oldRect = maze->GetJunctionRect(id);
+    uint64_t version = maze->version;
+    bool set = maze->SetJunctionRect(id, rect);
+    if (maze->version != version) {
+        step.rect = rect;
+        command.steps.push_back(step);
+    }
+    End();
+    return set;
+}
+void MazeHistory::AddTunnel(JunctionID from, JunctionID to)
+{
+    Begin();
+    maze->AddTunnel(from, to);
+    End();
+}
+void MazeHistory::RemoveTunnel(Tunnel t)
+{
+    Begin();
+    maze->RemoveTunnel(t);
+    End();
+}
+void MazeHistory::SetTagsAt(int x, int y, vector<string> &tags)
+{
+    Begin();
+    vector<TagID> old = maze->GetTagsAt(x, y);
+    maze->SetTagsAt(x, y, tags);
+    const vector<TagID> &now = maze->GetTagsAt(x, y);
+    if (now != old) {
+        EditStep step = {};
+        step.kind = CHANGE_SET_TAGS;
+        step.coord = { x, y };
+        step.other = AddTags(old);
+        step.value = AddTags(now);
+        command.steps.push_back(step);
+    }
+    End();
+}
+void MazeHistory::PruneJunctions()
+{
+    // The same as Maze::PruneJunctions, through the edit methods so that
+    // every removed junction can be put back.
+    Begin();
+    vector<JunctionID> junctions = maze->GetJunctionList();
+    vector<JunctionID> connected;
+    for (JunctionID j: junctions) {
+        if (!maze->IsPrunable(j, connected))
+            continue;
+        RemoveJunction(j);
+        if (connected.size() == 2)
+            AddTunnel(connected[0], connected[1]);
+    }
+    End();
+}
+
+//
+// Command methods.
+//
+void MazeHistory::OnChange(const MazeChange &change)
+{
+    if (applying)
+        return;
+    if (depth == 0) {
+        // The maze changed under the history, undoing across the change
+        // would not give the maze back as it was.
+        Clear();
+        return;
+    }
+
+    // The edit methods add the steps that need the state before them.
+    EditStep step = {};
+    step.kind = change.kind;
+    step.id = change.id;
+    if (change.kind == CHANGE_ADD_JUNCTION) {
+        step.value = maze->GetJunction(change.id).name;
+        step.coord = change.lo;
+        step.rect = maze->GetJunctionRect(change.id);
+    } else if (change.kind == CHANGE_ADD_TUNNEL || change.kind == CHANGE_REMOVE_TUNNEL) {
+        step.other = change.other;
+    } else {
+        return;
+    }
+    command.steps.push_back(step);
+}
+void MazeHistory::Begin()
+{
+    // Edit methods call each other, the outermost makes the command.
+    if (depth++ > 0)
+        return;
+    command = EditCommand();
+    command.mergeKey = mergeKey;
+}
+void MazeHistory::End()
+{
+    if (--depth > 0 || command.steps.empty())
+        return;
+    for (EditCommand &redo: redos)
+        memory -= redo.memory;
+    redos.clear();
+
+    if (merging && command.mergeKey != 0 && undos.size() > 0 && undos.back().mergeKey == command.mergeKey) {
+        Merge();
+    } else {
+        command.steps.shrink_to_fit();
+        command.tags.shrink_to_fit();
+        command.memory = CommandMemory(command);
+        memory += command.memory;
+        undos.push_back(move(command));
+    }
+    merging = true;
+
+    // The latest command stays even when it alone is over the limit.
+    while (memory > memoryLimit && undos.size() > 1) {
+        memory -= undos.front().memory;
+        undos.pop_front();
+    }
+}
+void MazeHistory::Merge()
+{
+    EditCommand &last = undos.back();
+    memory -= last.memory;
+
+    // A value edited again keeps the value from before the first edit,
+    // so a drag is one step however many frames it took.
+    EditStep &step = command.steps[0];
+    EditStep &previous = last.steps.back();
+    bool sameValue = command.steps.size() == 1 && step.kind == previous.kind && step.id == previous.id &&
+        (step.kind == CHANGE_RENAME_JUNCTION || step.kind == CHANGE_SET_RECT);
+    if (sameValue) {
+        previous.value = step.value;
+        previous.rect = step.rect;
+    } else {
+        uint32_t offset = last.tags.size();
+        for (EditStep &s: command.steps) {
+            if (s.kind == CHANGE_SET_TAGS) {
+                s.other += offset;
+                s.value += offset;
+            }
+            last.steps.push_back(s);
+        }
+        last.tags.insert(last.tags.end(), command.tags.begin(), command.tags.end());
+    }
+    last.memory = CommandMemory(last);
+    memory += last.memory;
+}
+uint32_t MazeHistory::AddTags(const vector<TagID> &tags)
+{
+    uint32_t offset = command.tags.size();
+    command.tags.push_back(tags.size());
+    command.tags.insert(command.tags.end(), tags.begin(), tags.end());
+    return offset;
+}
+void MazeHistory::Apply(EditCommand &edit, bool undo)
+{
+    // Undo takes the steps back newest first, redo makes them again in
+    // order. The changes are journaled as usual, only the history
+    // ignores them.
+    applying = true;
+    if (undo) {
+        for (size_t i = edit.steps.size(); i-- > 0;)
+            ApplyStep(edit, edit.steps[i], true);
+    } else {
+        for (EditStep &step: edit.steps)
+            ApplyStep(edit, step, false);
+    }
+    applying = false;
+}
+void MazeHistory::ApplyStep(EditCommand &edit, EditStep &step, bool undo)
+{
+    switch (step.kind) {
+    case CHANGE_ADD_JUNCTION:
+    case CHANGE_REMOVE_JUNCTION:
+        if ((step.kind == CHANGE_ADD_JUNCTION) != undo) {
+            // Split tunnels are steps of their own.
+            maze->AddJunction(step.coord.x, step.coord.y, maze->name_pool.Get(step.value), step.id, false);
+            if (!(maze->GetJunctionRect(step.id) == step.rect))
+                maze->SetJunctionRect(step.id, step.rect);
+        } else {
+            maze->RemoveJunction(step.id);
+        }
+        break;
+    case CHANGE_ADD_TUNNEL:
+    case CHANGE_REMOVE_TUNNEL:
+        if ((step.kind == CHANGE_ADD_TUNNEL) != undo)
+            maze->AddTunnel(step.id, step.other);
+        else
+            maze->RemoveTunnel({ step.id, step.other });
+        break;
+    case CHANGE_RENAME_JUNCTION:
+        maze->RenameJunction(step.id, maze->name_pool.Get(undo ? step.other : step.value));
+        break;
+    case CHANGE_SET_RECT:
+        maze->SetJunctionRect(step.id, undo ? step.oldRect : step.rect);
+        break;
+    case CHANGE_SET_TAGS: {
+        uint32_t offset = undo ? step.other : step.value;
+        auto begin = edit.tags.begin() + offset + 1;
+        vector<TagID> tags(begin, begin + edit.tags[offset]);
+        maze->SetTagsAt(step.coord.x, step.coord.y, tags);
+        break;
+    }
+    default:
+        break;
+    }
+}
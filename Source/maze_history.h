@@ -0,0 +1,93 @@
+#ifndef MAZE_HISTORY_H
+#define MAZE_HISTORY_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include "maze.h"
+
+using namespace std;
+
+// One primitive change and what it replaced. Tunnel steps keep the two
+// ends in id and other. Junction steps keep the name in value with the
+// coord and rect, to put the junction back. Renames and tag steps keep
+// the name or tag list they replaced in other and the one they set in
+// value, rect steps the rects in oldRect and rect.
+struct EditStep {
+    ChangeKind kind;
+    JunctionID id;
+    uint32_t other;
+    uint32_t value;
+    Coord coord;
+    JunctionRect rect;
+    JunctionRect oldRect;
+};
+
+// The steps of one undoable edit. The tag lists of the steps are stored
+// back to back in tags, each as its count followed by the tag IDs, and
+// the steps refer to them by offset.
+struct EditCommand {
+    uint64_t mergeKey = 0;
+    vector<EditStep> steps;
+    vector<TagID> tags;
+    size_t memory = 0;
+};
+
+// Undo and redo for the edits of a maze. Every edit goes through the
+// methods below, which follow the maze journal and keep only the steps
+// the edit made and what they replaced, never a copy of the maze. Undo
+// and redo replay those steps, so they cost as much as the edit did.
+// Edits made with the same nonzero mergeKey one after the other are one
+// command, such as a drag of a corner. The oldest commands are dropped
+// to stay within memoryLimit. An edit the history did not make, such as
+// loading or generating a maze, clears it.
+class MazeHistory {
+public:
+    uint64_t mergeKey = 0;
+    size_t memoryLimit = 256 << 20;
+
+    MazeHistory();
+    MazeHistory(const MazeHistory &other) = delete;
+    MazeHistory &operator=(const MazeHistory &other) = delete;
+    ~MazeHistory();
+
+    void SetMaze(Maze *maze);
+    void Clear();
+    bool CanUndo();
+    bool CanRedo();
+    bool Undo();
+    bool Redo();
+    size_t GetMemory();
+
+    // Edit methods.
+    void AddJunction(int x, int y, string name);
+    void RemoveJunction(JunctionID id);
+    bool RenameJunction(JunctionID id, string name);
+    bool SetJunctionRect(JunctionID id, JunctionRect rect);
+    void AddTunnel(JunctionID from, JunctionID to);
+    void RemoveTunnel(Tunnel t);
+    void SetTagsAt(int x, int y, vector<string> &tags);
+    void PruneJunctions();
+
+private:
+    Maze *maze = nullptr;
+    int subscriber = 0;
+    deque<EditCommand> undos;
+    vector<EditCommand> redos;
+    EditCommand command;
+    int depth = 0;
+    bool applying = false;
+    bool merging = false;
+    size_t memory = 0;
+
+    void OnChange(const MazeChange &change);
+    void Begin();
+    void End();
+    void Merge();
+    uint32_t AddTags(const vector<TagID> &tags);
+    void Apply(EditCommand &edit, bool undo);
+    void ApplyStep(EditCommand &edit, EditStep &step, bool undo);
+};
+
+#endif
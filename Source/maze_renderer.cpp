@@ -1,59 +1,335 @@
+#include <algorithm>
+#include <cstring>
+#include <rlgl.h>
 #include "maze_renderer.h"
 #include "arclib.h"
 
+// Every vertex sits on a line or a corner, the normal points the way it
+// moves out to give the line its width.
+static const char *lineVertexShader = R"(
+#version 330
+in vec3 vertexPosition;
+in vec3 vertexNormal;
+uniform mat4 mvp;
+uniform float halfWidth;
+uniform float minWidth;
+void main()
+{
+    vec2 offset = vertexNormal.xy * max(halfWidth, minWidth);
+    gl_Position = mvp * vec4(vertexPosition.xy + offset, 0.0, 1.0);
+}
+)";
+static const char *lineFragmentShader = R"(
+#version 330
+uniform vec4 colDiffuse;
+out vec4 finalColor;
+void main()
+{
+    finalColor = colDiffuse;
+}
+)";
+
 MazeRenderer::MazeRenderer()
 {
     raylibFont = GetFontDefault();
+    lineShader = LoadShaderFromMemory(lineVertexShader, lineFragmentShader);
+    lineMaterial = LoadMaterialDefault();
+    lineMaterial.shader = lineShader;
+    minWidthLoc = GetShaderLocation(lineShader, "minWidth");
+    halfWidthLoc = GetShaderLocation(lineShader, "halfWidth");
+}
+MazeRenderer::~MazeRenderer()
+{
+    UnloadChunks();
+    UnloadOverlays();
+    UnloadLods();
+    UnloadShader(lineShader);
+    MemFree(lineMaterial.maps);
 }
 void MazeRenderer::SetMaze(Maze *_maze)
 {
         maze = _maze;
+        UnloadChunks();
+        chunkVersion = maze->version;
+        UnloadOverlays();
+        UnloadLods();
+        // Lays the labels out again on the next frame.
+        labelFontSize = 0;
 }
 
-void MazeRenderer::DrawJunctionLabels() 
+//
+// Chunk methods.
+//
+static void PushVertex(vector<float> &vertices, vector<float> &normals, Vector2 pos, Vector2 normal)
+{
+    vertices.insert(vertices.end(), { pos.x, pos.y, 0 });
+    normals.insert(normals.end(), { normal.x, normal.y, 0 });
+}
+static void PushLine(vector<float> &vertices, vector<float> &normals, Vector2 a, Vector2 b)
+{
+    // Two triangles along a-b, pushed apart by the shader.
+    Vector2 d = Vector2Normalize(Vector2Subtract(b, a));
+    Vector2 n = { -d.y, d.x };
+    Vector2 m = { d.y, -d.x };
+    PushVertex(vertices, normals, a, m);
+    PushVertex(vertices, normals, a, n);
+    PushVertex(vertices, normals, b, n);
+    PushVertex(vertices, normals, a, m);
+    PushVertex(vertices, normals, b, n);
+    PushVertex(vertices, normals, b, m);
+}
+static void PushRect(vector<float> &vertices, vector<float> &normals, Rectangle r)
+{
+    Vector2 zero = { 0, 0 };
+    PushVertex(vertices, normals, { r.x, r.y }, zero);
+    PushVertex(vertices, normals, { r.x+r.width, r.y }, zero);
+    PushVertex(vertices, normals, { r.x+r.width, r.y+r.height }, zero);
+    PushVertex(vertices, normals, { r.x, r.y }, zero);
+    PushVertex(vertices, normals, { r.x+r.width, r.y+r.height }, zero);
+    PushVertex(vertices, normals, { r.x, r.y+r.height }, zero);
+}
+static void PushClippedLine(vector<float> &vertices, vector<float> &normals, Vector2 a, Vector2 b, Rectangle clip)
+{
+    // Keeps the part of an axis aligned line inside clip. A line on the
+    // border belongs to the chunk below or right of it.
+    if (a.y == b.y) {
+        if (a.y < clip.y || a.y >= clip.y+clip.height)
+            return;
+        float x0 = fmaxf(fminf(a.x, b.x), clip.x);
+        float x1 = fminf(fmaxf(a.x, b.x), clip.x+clip.width);
+        if (x0 < x1)
+            PushLine(vertices, normals, { x0, a.y }, { x1, a.y });
+    } else if (a.x == b.x) {
+        if (a.x < clip.x || a.x >= clip.x+clip.width)
+            return;
+        float y0 = fmaxf(fminf(a.y, b.y), clip.y);
+        float y1 = fminf(fmaxf(a.y, b.y), clip.y+clip.height);
+        if (y0 < y1)
+            PushLine(vertices, normals, { a.x, y0 }, { a.x, y1 });
+    }
+}
+void MazeRenderer::BuildChunk(RenderChunk &chunk, int cx, int cy)
 {
-    vector<JunctionID> junctions = maze->GetJunctionList();
-    for (JunctionID id: junctions){
-        Junction &j = maze->GetJunction(id);
+    UnloadChunk(chunk);
+    chunk.built = true;
+    chunk.stale = false;
+
+    Coord lo = { cx * RENDER_CHUNK_SIZE, cy * RENDER_CHUNK_SIZE };
+    Coord hi = { lo.x + RENDER_CHUNK_SIZE-1, lo.y + RENDER_CHUNK_SIZE-1 };
+    Rectangle clip = {
+        (float)lo.x * tileSize, (float)lo.y * tileSize,
+        (float)RENDER_CHUNK_SIZE * tileSize, (float)RENDER_CHUNK_SIZE * tileSize
+    };
+    vector<float> vertices[LAYER_COUNT];
+    vector<float> normals[LAYER_COUNT];
+
+    maze->QueryTunnels(lo, hi, visibleTunnels);
+    for (Tunnel t: visibleTunnels) {
+        Coord coord1 = maze->GetJunctionCoord(t.from);
+        Coord coord2 = maze->GetJunctionCoord(t.to);
+        Vector2 pos1 = Vector2Scale({ coord1.x+0.5f, coord1.y+0.5f }, tileSize);
+        Vector2 pos2 = Vector2Scale({ coord2.x+0.5f, coord2.y+0.5f }, tileSize);
+        PushClippedLine(vertices[LAYER_TUNNELS], normals[LAYER_TUNNELS], pos1, pos2, clip);
+    }
+
+    // Outlines run half a unit inside the rectangle, so with their
+    // width of one unit they cover its border cells' edge.
+    maze->QueryJunctions(lo, hi, visibleJunctions);
+    for (JunctionID id: visibleJunctions) {
         Rectangle rect = GetJunctionRect(id);
-        const char *text = j.name.c_str();
+        Rectangle fill = GetCollisionRec(rect, clip);
+        if (fill.width > 0 && fill.height > 0)
+            PushRect(vertices[LAYER_FILLS], normals[LAYER_FILLS], fill);
 
-        Vector2 targetPosWorld = { rect.x - 5, rect.y - 5 };
-        Vector2 tilePosWorld = { rect.x, rect.y };
-        Vector2 targetPos = GetWorldToScreen2D(targetPosWorld, arcGlobal.camera);
-        Vector2 tilePos = GetWorldToScreen2D(tilePosWorld, arcGlobal.camera);
+        float x0 = rect.x, y0 = rect.y, x1 = rect.x+rect.width, y1 = rect.y+rect.height;
+        vector<float> &v = vertices[LAYER_OUTLINES];
+        vector<float> &n = normals[LAYER_OUTLINES];
+        PushClippedLine(v, n, { x0, y0+0.5f }, { x1, y0+0.5f }, clip);
+        PushClippedLine(v, n, { x0, y1-0.5f }, { x1, y1-0.5f }, clip);
+        PushClippedLine(v, n, { x0+0.5f, y0 }, { x0+0.5f, y1 }, clip);
+        PushClippedLine(v, n, { x1-0.5f, y0 }, { x1-0.5f, y1 }, clip);
+    }
 
-        int textWidth = MeasureText(text, fontSize);
-        Vector2 textPos = { targetPos.x - textWidth, targetPos.y - fontSize };
-        
-        float w = 2.0;
-        textPos.y -= w;
+    for (int layer = 0; layer < LAYER_COUNT; layer++) {
+        if (vertices[layer].empty())
+            continue;
+        // The GPU keeps its copy, the mesh does not need one.
+        Mesh &mesh = chunk.layers[layer];
+        size_t bytes = vertices[layer].size() * sizeof(float);
+        mesh.vertexCount = vertices[layer].size() / 3;
+        mesh.triangleCount = mesh.vertexCount / 3;
+        mesh.vertices = (float *)MemAlloc(bytes);
+        mesh.normals = (float *)MemAlloc(bytes);
+        memcpy(mesh.vertices, vertices[layer].data(), bytes);
+        memcpy(mesh.normals, normals[layer].data(), bytes);
+        UploadMesh(&mesh, false);
+        MemFree(mesh.vertices);
+        MemFree(mesh.normals);
+        mesh.vertices = nullptr;
+        mesh.normals = nullptr;
+    }
+}
+void MazeRenderer::UnloadChunk(RenderChunk &chunk)
+{
+    for (int layer = 0; layer < LAYER_COUNT; layer++) {
+        if (chunk.layers[layer].vaoId != 0)
+            UnloadMesh(chunk.layers[layer]);
+        chunk.layers[layer] = {};
+    }
+    chunk.built = false;
+}
+void MazeRenderer::UnloadChunks()
+{
+    for (auto &pair: chunks)
+        UnloadChunk(pair.second);
+    chunks.clear();
+}
+void MazeRenderer::SyncChunks()
+{
+    // Marks the chunks under the changes since the last frame, or all of
+    // them when the journal no longer reaches back that far.
+    if (chunkVersion == maze->version)
+        return;
+    bool all = !maze->GetChanges(chunkVersion, changes);
+    chunkVersion = maze->version;
+    for (MazeChange &change: changes) {
+        // Tags and names are not in the meshes.
+        if (change.kind == CHANGE_SET_TAGS || change.kind == CHANGE_RENAME_JUNCTION)
+            continue;
+        if (change.kind == CHANGE_ERASE) {
+            all = true;
+            break;
+        }
+        int64_t x0 = change.lo.x >> RENDER_CHUNK_BITS, x1 = change.hi.x >> RENDER_CHUNK_BITS;
+        int64_t y0 = change.lo.y >> RENDER_CHUNK_BITS, y1 = change.hi.y >> RENDER_CHUNK_BITS;
+        if ((x1-x0+1) * (y1-y0+1) > (int64_t)chunks.size()) {
+            for (auto &pair: chunks) {
+                Coord c = Coord(pair.first);
+                if (c.x >= x0 && c.x <= x1 && c.y >= y0 && c.y <= y1)
+                    pair.second.stale = true;
+            }
+            continue;
+        }
+        for (int64_t cy = y0; cy <= y1; cy++) {
+            for (int64_t cx = x0; cx <= x1; cx++) {
+                auto it = chunks.find(Coord((int)cx, (int)cy).ToKey());
+                if (it != chunks.end())
+                    it->second.stale = true;
+            }
+        }
+    }
+    if (all) {
+        for (auto &pair: chunks)
+            pair.second.stale = true;
+    }
+}
+void MazeRenderer::DrawLayer(RenderLayer layer, Color color, float halfWidth)
+{
+    // Draws one layer of every chunk in view, building chunks the maze
+    // changed under while there is time left in the frame.
+    Coord lo, hi, mazeLo, mazeHi;
+    if (!maze->GetBounds(mazeLo, mazeHi))
+        return;
+    GetVisibleCells(0, lo, hi);
+    lo = { max(lo.x, mazeLo.x), max(lo.y, mazeLo.y) };
+    hi = { min(hi.x, mazeHi.x), min(hi.y, mazeHi.y) };
+    if (lo.x > hi.x || lo.y > hi.y)
+        return;
 
-        DrawLineZ(tilePos, targetPos, WHITE, w, 1.0);
-        DrawLineZ(targetPos, { textPos.x - 3, targetPos.y }, WHITE, w, 1.0);
-        DrawText(text, textPos.x, textPos.y, fontSize, WHITE);
+    SyncChunks();
+    drawCount++;
+    float minWidth = 0.5f / arcGlobal.camera.zoom;
+    SetShaderValue(lineShader, minWidthLoc, &minWidth, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(lineShader, halfWidthLoc, &halfWidth, SHADER_UNIFORM_FLOAT);
+    lineMaterial.maps[MATERIAL_MAP_DIFFUSE].color = color;
+
+    // Meshes skip the shape batch, flush it first to keep the draw order.
+    rlDrawRenderBatchActive();
+    rlDisableBackfaceCulling();
+    double deadline = GetTime() + RENDER_BUILD_BUDGET;
+    for (int cy = lo.y >> RENDER_CHUNK_BITS; cy <= hi.y >> RENDER_CHUNK_BITS; cy++) {
+        for (int cx = lo.x >> RENDER_CHUNK_BITS; cx <= hi.x >> RENDER_CHUNK_BITS; cx++) {
+            RenderChunk &chunk = chunks[Coord(cx, cy).ToKey()];
+            bool stale = !chunk.built || chunk.stale;
+            if (stale && GetTime() < deadline)
+                BuildChunk(chunk, cx, cy);
+            chunk.lastDraw = drawCount;
+            Mesh &mesh = chunk.layers[layer];
+            if (mesh.vertexCount > 0)
+                DrawMesh(mesh, lineMaterial, MatrixIdentity());
+        }
+    }
+    rlEnableBackfaceCulling();
+
+    // Forget the chunks that were not drawn for a while.
+    if (chunks.size() > RENDER_CHUNK_CACHE) {
+        for (auto it = chunks.begin(); it != chunks.end();) {
+            if (it->second.lastDraw + LAYER_COUNT < drawCount) {
+                UnloadChunk(it->second);
+                it = chunks.erase(it);
+            } else {
+                it++;
+            }
+        }
     }
 }
-void MazeRenderer::DrawJunctions()
+
+void MazeRenderer::GetVisibleCells(float margin, Coord &lo, Coord &hi)
 {
-    vector<JunctionID> junctions = maze->GetJunctionList();
-    for (JunctionID id: junctions){
-        Junction &j = maze->GetJunction(id);
-        Rectangle rect = GetJunctionRect(id);
-        DrawRectangleRec(rect, junctionFillColor);
-        DrawRectangleLinesZ(rect, 1.0, junctionColor, 0, 1);
+    // Cells under the camera, with a margin in screen pixels for whatever
+    // is drawn outside of its cell.
+    Rectangle worldRect = GetCameraWorldRect(arcGlobal.camera);
+    float m = margin / arcGlobal.camera.zoom;
+    float limit = 1e9;
+    lo.x = (int)Clamp(floorf((worldRect.x - m) / tileSize), -limit, limit);
+    lo.y = (int)Clamp(floorf((worldRect.y - m) / tileSize), -limit, limit);
+    hi.x = (int)Clamp(floorf((worldRect.x + worldRect.width + m) / tileSize), -limit, limit);
+    hi.y = (int)Clamp(floorf((worldRect.y + worldRect.height + m) / tileSize), -limit, limit);
+}
+
+void MazeRenderer::DrawJunctionLabels() 
+{
+    // Junctions are not told apart from the pyramid, nor are their labels.
+    if (arcGlobal.camera.zoom < LOD_ZOOM)
+        return;
+    Camera2D &camera = arcGlobal.camera;
+    bool moved = camera.target.x != labelCamera.target.x || camera.target.y != labelCamera.target.y ||
+        camera.offset.x != labelCamera.offset.x || camera.offset.y != labelCamera.offset.y ||
+        camera.zoom != labelCamera.zoom || camera.rotation != labelCamera.rotation;
+    if (moved || maze->version != labelVersion || fontSize != labelFontSize ||
+        GetScreenWidth() != labelScreenWidth || GetScreenHeight() != labelScreenHeight)
+        PlaceLabels();
+
+    // Lines first and all text after, to keep each in one batch.
+    float w = 2.0;
+    for (PlacedLabel &label: placedLabels) {
+        DrawLineZ(label.tilePos, label.targetPos, WHITE, w, 1.0);
+        DrawLineZ(label.targetPos, { label.textPos.x - 3, label.targetPos.y }, WHITE, w, 1.0);
+    }
+    for (PlacedLabel &label: placedLabels) {
+        for (LabelGlyph &glyph: label.layout->glyphs) {
+            Rectangle dest = glyph.dest;
+            dest.x += label.textPos.x;
+            dest.y += label.textPos.y;
+            DrawTexturePro(raylibFont.texture, glyph.source, dest, { 0, 0 }, 0, WHITE);
+        }
     }
 }
+void MazeRenderer::DrawJunctions()
+{
+    if (DrawLod(LOD_JUNCTIONS, junctionColor))
+        return;
+    DrawLayer(LAYER_FILLS, junctionFillColor, 0);
+    DrawLayer(LAYER_OUTLINES, junctionColor, 0.5);
+}
 void MazeRenderer::DrawTunnels()
 {
-    vector<Tunnel> tunnels = maze->GetTunnelList();
-    for(Tunnel t: tunnels){
-        Coord coord1 = maze->GetJunctionCoord(t.from);
-        Coord coord2 = maze->GetJunctionCoord(t.to);
-        Vector2 pos1 = Vector2Scale({ coord1.x+0.5f, coord1.y+0.5f }, tileSize);
-        Vector2 pos2 = Vector2Scale({ coord2.x+0.5f, coord2.y+0.5f }, tileSize);
-        DrawLineZ(pos1, pos2, tunnelColor, tunnelSize, 0.5);
-    }
+    // A tunnel covers part of its cell, at least a pixel like the meshes.
+    Color color = tunnelColor;
+    color.a = (unsigned char)(color.a * Clamp(fmaxf(tunnelSize, 1 / arcGlobal.camera.zoom) / tileSize, 0, 1));
+    if (DrawLod(LOD_TUNNELS, color))
+        return;
+    DrawLayer(LAYER_TUNNELS, tunnelColor, tunnelSize/2.0f);
 }
 void MazeRenderer::DrawGrid()
 {
@@ -82,55 +358,468 @@ void MazeRenderer::DrawIdMap()
 {
     if (arcGlobal.camera.zoom < 2)
         return;
-    Rectangle worldRect = GetCameraWorldRect(arcGlobal.camera);
-    int tx = worldRect.x / tileSize;
-    int ty = worldRect.y / tileSize;
-    int w = worldRect.width / tileSize;
-    int h = worldRect.height / tileSize;
+    DrawOverlay(OVERLAY_IDS);
+}
+void MazeRenderer::DrawTags()
+{
+    if (arcGlobal.camera.zoom < 2)
+        return;
+    DrawOverlay(OVERLAY_TAGS);
+}
+void MazeRenderer::DrawIdCell(int gx, int gy, Vector2 pos)
+{
+    JunctionID id = maze->GetJunctionAt(gx, gy);
+    const char *text = TextFormat("%d", id);
+    int w = MeasureText(text, 1); 
+    DrawRectangle(pos.x-2, pos.y, w+4, 10, junctionFillColor);
+    DrawText(text, pos.x, pos.y, 1, DARKGRAY);
+}
+void MazeRenderer::DrawTagCell(int gx, int gy, Vector2 pos)
+{
+    const vector<TagID> &tags = maze->GetTagsAt(gx, gy);
+    int spacing = 15;
+    for (int i = 0; i < tags.size(); i++) {
+        const char *text = maze->GetTagName(tags[i]).c_str();
+        int w = MeasureText(text, 15); 
+        DrawRectangle(pos.x-2, pos.y + spacing*i, w+4, 15, junctionFillColor);
+        DrawText(text, pos.x, pos.y + spacing*i, 15, BLUE);
+    }
+}
+
+//
+// Overlay methods.
+//
+void MazeRenderer::BuildOverlay(OverlayKind kind, OverlayChunk &chunk, int cx, int cy, float scale)
+{
+    int size = OVERLAY_CHUNK_SIZE * tileSize * scale + OVERLAY_MARGIN;
+    if (chunk.texture.id != 0 && chunk.texture.texture.width != size) {
+        UnloadRenderTexture(chunk.texture);
+        chunk.texture = {};
+    }
+    if (chunk.texture.id == 0)
+        chunk.texture = LoadRenderTexture(size, size);
+    chunk.built = true;
+    chunk.scale = scale;
+
+    // Cells are drawn as they were on screen at this scale, the texture
+    // only holds the text over the empty background.
+    float cell = tileSize * scale;
+    BeginTextureMode(chunk.texture);
+    ClearBackground(BLANK);
+    for (int x = 0; x < OVERLAY_CHUNK_SIZE; x++) {
+        for (int y = 0; y < OVERLAY_CHUNK_SIZE; y++) {
+            int gx = cx*OVERLAY_CHUNK_SIZE + x;
+            int gy = cy*OVERLAY_CHUNK_SIZE + y;
+            Vector2 pos = { x*cell, y*cell };
+            if (kind == OVERLAY_IDS)
+                DrawIdCell(gx, gy, pos);
+            else
+                DrawTagCell(gx, gy, pos);
+        }
+    }
+    EndTextureMode();
+}
+void MazeRenderer::UnloadOverlays()
+{
+    for (int kind = 0; kind < OVERLAY_COUNT; kind++) {
+        for (auto &pair: overlays[kind]) {
+            if (pair.second.texture.id != 0)
+                UnloadRenderTexture(pair.second.texture);
+        }
+        overlays[kind].clear();
+    }
+}
+void MazeRenderer::DrawOverlay(OverlayKind kind)
+{
+    // Blits the textures of the chunks in view, redrawing the stale ones
+    // while there is time left in the frame.
+    CellGrid &grid = kind == OVERLAY_IDS ? maze->coord_to_id : maze->coord_to_tags;
+    unordered_map<CoordID, OverlayChunk, CoordHash> &cache = overlays[kind];
+    float zoom = arcGlobal.camera.zoom;
+    // Quarter powers of two, so zooming redraws every few steps only.
+    float scale = fminf(exp2f(roundf(log2f(zoom)*4) / 4), OVERLAY_MAX_SCALE);
 
-    for (int x = 0; x < w+4; x++) {
-        for (int y = 0; y < h+4; y++) {
-            int gx = tx+x;
-            int gy = ty+y;
-            JunctionID id = maze->GetJunctionAt(gx, gy);
+    // Text reaches right and down out of its chunk, so look further left and up.
+    Coord lo, hi;
+    GetVisibleCells(OVERLAY_MARGIN * zoom / scale, lo, hi);
+    drawCount++;
+    double deadline = GetTime() + RENDER_BUILD_BUDGET;
+    for (int cx = lo.x >> OVERLAY_CHUNK_BITS; cx <= hi.x >> OVERLAY_CHUNK_BITS; cx++) {
+        for (int cy = lo.y >> OVERLAY_CHUNK_BITS; cy <= hi.y >> OVERLAY_CHUNK_BITS; cy++) {
+            int bx = (cx * OVERLAY_CHUNK_SIZE) >> GRID_CHUNK_BITS;
+            int by = (cy * OVERLAY_CHUNK_SIZE) >> GRID_CHUNK_BITS;
+            uint64_t revision = grid.GetRevision(bx, by);
+            // Blocks that never had a tag have nothing to show.
+            if (kind == OVERLAY_TAGS && revision == 0)
+                continue;
 
-            const char *text = TextFormat("%d", id);
-            int w = MeasureText(text, 1); 
-            Vector2 screenPos = GetWorldToScreen2D({ gx*tileSize, gy*tileSize }, arcGlobal.camera);
+            OverlayChunk &chunk = cache[Coord(cx, cy).ToKey()];
+            bool stale = !chunk.built || chunk.revision != revision || chunk.scale != scale;
+            if (stale && GetTime() < deadline) {
+                BuildOverlay(kind, chunk, cx, cy, scale);
+                chunk.revision = revision;
+            }
+            chunk.lastDraw = drawCount;
+            if (!chunk.built)
+                continue;
 
-            DrawRectangle(screenPos.x-2, screenPos.y, w+4, 10, junctionFillColor);
-            DrawText(text, screenPos.x, screenPos.y, 1, DARKGRAY);
+            // Render textures are upside down.
+            float f = zoom / chunk.scale;
+            float size = chunk.texture.texture.width;
+            Vector2 pos = GetWorldToScreen2D({ (float)cx*OVERLAY_CHUNK_SIZE*tileSize, (float)cy*OVERLAY_CHUNK_SIZE*tileSize }, arcGlobal.camera);
+            Rectangle source = { 0, 0, size, -size };
+            Rectangle dest = { pos.x, pos.y, size*f, size*f };
+            DrawTexturePro(chunk.texture.texture, source, dest, { 0, 0 }, 0, WHITE);
+        }
+    }
+
+    if (cache.size() > OVERLAY_CACHE) {
+        for (auto it = cache.begin(); it != cache.end();) {
+            if (it->second.lastDraw != drawCount) {
+                if (it->second.texture.id != 0)
+                    UnloadRenderTexture(it->second.texture);
+                it = cache.erase(it);
+            } else {
+                it++;
+            }
         }
     }
 }
-void MazeRenderer::DrawTags()
+
+//
+// Level of detail methods.
+//
+LodTile *MazeRenderer::UpdateLod(int level, int tx, int ty, double deadline, bool &complete)
 {
-    if (arcGlobal.camera.zoom < 2)
-        return;
-    Rectangle worldRect = GetCameraWorldRect(arcGlobal.camera);
-    int tx = worldRect.x / tileSize;
-    int ty = worldRect.y / tileSize;
-    int w = worldRect.width / tileSize;
-    int h = worldRect.height / tileSize;
-    int spacing = 15;
+    // Brings a tile up to date with the maze, its children first. Returns
+    // null where there is nothing to draw yet, and clears complete when
+    // out of time before all of it was built.
+    CoordID key = Coord(tx, ty).ToKey();
+    auto it = lods[level].find(key);
+    LodTile *tile = it != lods[level].end() ? &it->second : nullptr;
+    if (tile != nullptr && tile->version == maze->version) {
+        tile->lastDraw = drawCount;
+        return tile;
+    }
+    // Out of time, what is there has to do for this frame.
+    if (GetTime() >= deadline) {
+        complete = false;
+        if (tile != nullptr)
+            tile->lastDraw = drawCount;
+        return tile;
+    }
+    bool done = true;
+    if (level == 0) {
+        uint64_t idRevision = maze->coord_to_id.GetRevision(tx, ty);
+        uint64_t tunnelRevision = maze->tunnel_index.GetRevision(tx, ty);
+        if (idRevision == 0 && tunnelRevision == 0)
+            return nullptr;
+        bool stale = tile == nullptr || tile->idRevision != idRevision || tile->tunnelRevision != tunnelRevision;
+        if (stale && GetTime() < deadline) {
+            tile = &lods[0][key];
+            BuildLod(*tile, tx, ty);
+            tile->idRevision = idRevision;
+            tile->tunnelRevision = tunnelRevision;
+        } else if (stale) {
+            done = false;
+        }
+    } else {
+        // Builds only count up, a child built again shows in the newest.
+        LodTile *children[4];
+        uint64_t childBuild = 0;
+        for (int i = 0; i < 4; i++) {
+            children[i] = UpdateLod(level-1, tx*2 + i%2, ty*2 + i/2, deadline, done);
+            if (children[i] != nullptr)
+                childBuild = max(childBuild, children[i]->build);
+        }
+        if (childBuild == 0) {
+            complete = complete && done;
+            return nullptr;
+        }
+        bool stale = tile == nullptr || tile->childBuild != childBuild;
+        if (stale && GetTime() < deadline) {
+            tile = &lods[level][key];
+            MergeLod(*tile, children);
+            tile->childBuild = childBuild;
+        } else if (stale) {
+            done = false;
+        }
+    }
+    complete = complete && done;
+    if (tile != nullptr) {
+        tile->lastDraw = drawCount;
+        tile->version = done ? maze->version : 0;
+    }
+    return tile;
+}
+void MazeRenderer::BuildLod(LodTile &tile, int tx, int ty)
+{
+    // A texel per cell of the block, covered or not.
+    for (int layer = 0; layer < LOD_LAYER_COUNT; layer++)
+        tile.density[layer].assign(LOD_TILE_SIZE*LOD_TILE_SIZE, 0);
+    Coord lo = { tx*LOD_TILE_SIZE, ty*LOD_TILE_SIZE };
+    Coord hi = { lo.x + LOD_TILE_SIZE-1, lo.y + LOD_TILE_SIZE-1 };
+
+    uint8_t *junctions = tile.density[LOD_JUNCTIONS].data();
+    for (int y = 0; y < LOD_TILE_SIZE; y++) {
+        for (int x = 0; x < LOD_TILE_SIZE; x++) {
+            if (maze->GetJunctionAt(lo.x + x, lo.y + y) != 0)
+                junctions[y*LOD_TILE_SIZE + x] = 255;
+        }
+    }
+
+    uint8_t *tunnels = tile.density[LOD_TUNNELS].data();
+    maze->QueryTunnels(lo, hi, visibleTunnels);
+    for (Tunnel t: visibleTunnels) {
+        Coord a = maze->GetJunctionCoord(t.from);
+        Coord b = maze->GetJunctionCoord(t.to);
+        int x0 = max(min(a.x, b.x), lo.x), x1 = min(max(a.x, b.x), hi.x);
+        int y0 = max(min(a.y, b.y), lo.y), y1 = min(max(a.y, b.y), hi.y);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++)
+                tunnels[(y - lo.y)*LOD_TILE_SIZE + x - lo.x] = 255;
+        }
+    }
 
-    for (int x = 0; x < w+4; x++) {
-        for (int y = 0; y < h+4; y++) {
-            int gx = tx+x;
-            int gy = ty+y;
-            
-            vector<string> tags = maze->GetTagsAt(gx, gy);
-
-            for (int i = 0; i < tags.size(); i++) {
-                const char *text = tags[i].c_str();
-                int w = MeasureText(text, 15); 
-                Vector2 screenPos = GetWorldToScreen2D({ gx*tileSize, gy*tileSize }, arcGlobal.camera);
-                screenPos.y += spacing*i;
-                DrawRectangle(screenPos.x-2, screenPos.y, w+4, 15, junctionFillColor);
-                DrawText(text, screenPos.x, screenPos.y, 15, BLUE);
+    tile.build = ++lodBuilds;
+    for (int layer = 0; layer < LOD_LAYER_COUNT; layer++)
+        tile.uploaded[layer] = false;
+}
+void MazeRenderer::MergeLod(LodTile &tile, LodTile *children[4])
+{
+    // Every texel is the mean of the 2x2 texels under it, missing children
+    // count as empty.
+    int half = LOD_TILE_SIZE / 2;
+    for (int layer = 0; layer < LOD_LAYER_COUNT; layer++) {
+        vector<uint8_t> &density = tile.density[layer];
+        density.assign(LOD_TILE_SIZE*LOD_TILE_SIZE, 0);
+        for (int i = 0; i < 4; i++) {
+            if (children[i] == nullptr)
+                continue;
+            const uint8_t *src = children[i]->density[layer].data();
+            uint8_t *dst = density.data() + (i/2)*half*LOD_TILE_SIZE + (i%2)*half;
+            for (int y = 0; y < half; y++) {
+                for (int x = 0; x < half; x++) {
+                    const uint8_t *s = src + 2*y*LOD_TILE_SIZE + 2*x;
+                    int sum = s[0] + s[1] + s[LOD_TILE_SIZE] + s[LOD_TILE_SIZE+1];
+                    dst[y*LOD_TILE_SIZE + x] = (sum + 2) / 4;
+                }
+            }
+        }
+        tile.uploaded[layer] = false;
+    }
+    tile.build = ++lodBuilds;
+}
+void MazeRenderer::UnloadLods()
+{
+    for (int level = 0; level < LOD_LEVELS; level++) {
+        for (auto &pair: lods[level]) {
+            for (Texture2D &texture: pair.second.textures) {
+                if (texture.id != 0)
+                    UnloadTexture(texture);
+            }
+        }
+        lods[level].clear();
+    }
+}
+bool MazeRenderer::DrawLod(LodLayer layer, Color color)
+{
+    // Draws the layer from the pyramid if zoomed out far enough, returns
+    // false to have the meshes drawn instead.
+    float zoom = arcGlobal.camera.zoom;
+    if (zoom >= LOD_ZOOM)
+        return false;
+    Coord lo, hi, mazeLo, mazeHi;
+    if (!maze->GetBounds(mazeLo, mazeHi))
+        return true;
+    GetVisibleCells(0, lo, hi);
+    lo = { max(lo.x, mazeLo.x), max(lo.y, mazeLo.y) };
+    hi = { min(hi.x, mazeHi.x), min(hi.y, mazeHi.y) };
+    if (lo.x > hi.x || lo.y > hi.y)
+        return true;
+
+    // The finest level without more texels than pixels.
+    int level = 0;
+    while (level < LOD_LEVELS-1 && tileSize * zoom * (1 << level) < 1)
+        level++;
+    int bits = LOD_TILE_BITS + level;
+    float size = (float)(LOD_TILE_SIZE << level) * tileSize;
+
+    drawCount++;
+    double deadline = GetTime() + RENDER_BUILD_BUDGET;
+    vector<uint8_t> pixels;
+    for (int ty = lo.y >> bits; ty <= hi.y >> bits; ty++) {
+        for (int tx = lo.x >> bits; tx <= hi.x >> bits; tx++) {
+            bool complete = true;
+            LodTile *tile = UpdateLod(level, tx, ty, deadline, complete);
+            if (tile == nullptr)
+                continue;
+
+            // White with the density as alpha, tinted when drawn.
+            Texture2D &texture = tile->textures[layer];
+            if (!tile->uploaded[layer]) {
+                pixels.resize(2*LOD_TILE_SIZE*LOD_TILE_SIZE);
+                for (int i = 0; i < LOD_TILE_SIZE*LOD_TILE_SIZE; i++) {
+                    pixels[2*i] = 255;
+                    pixels[2*i + 1] = tile->density[layer][i];
+                }
+                if (texture.id == 0) {
+                    Image image = { pixels.data(), LOD_TILE_SIZE, LOD_TILE_SIZE, 1, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA };
+                    texture = LoadTextureFromImage(image);
+                    SetTextureFilter(texture, TEXTURE_FILTER_BILINEAR);
+                } else {
+                    UpdateTexture(texture, pixels.data());
+                }
+                tile->uploaded[layer] = true;
             }
+            Rectangle source = { 0, 0, LOD_TILE_SIZE, LOD_TILE_SIZE };
+            Rectangle dest = { tx*size, ty*size, size, size };
+            DrawTexturePro(texture, source, dest, { 0, 0 }, 0, color);
         }
     }
+
+    // Forget the tiles under other parts of the maze.
+    size_t count = 0;
+    for (auto &tiles: lods)
+        count += tiles.size();
+    if (count > LOD_CACHE) {
+        for (auto &tiles: lods) {
+            for (auto it = tiles.begin(); it != tiles.end();) {
+                if (it->second.lastDraw != drawCount) {
+                    for (Texture2D &texture: it->second.textures) {
+                        if (texture.id != 0)
+                            UnloadTexture(texture);
+                    }
+                    it = tiles.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//
+// Label methods.
+//
+void MazeRenderer::PlaceLabels()
+{
+    if (labelFontSize != fontSize || labelLayouts.size() > LABEL_CACHE) {
+        labelLayouts.clear();
+        labelFontSize = fontSize;
+    }
+    labelCamera = arcGlobal.camera;
+    labelVersion = maze->version;
+    labelScreenWidth = GetScreenWidth();
+    labelScreenHeight = GetScreenHeight();
+
+    // Labels sit above and left of their junction, look further right and
+    // a line further down for junctions whose label still reaches into view.
+    float w = 2.0;
+    Coord lo, right, down, unused;
+    GetVisibleCells(0, lo, unused);
+    GetVisibleCells(fontSize*16, unused, right);
+    GetVisibleCells(fontSize + w + 5, unused, down);
+    maze->QueryJunctions(lo, { right.x, down.y }, visibleJunctions);
+
+    // Bottom right first, so a placed label covers the junctions that come
+    // after it. The order stays the same while the camera moves.
+    labelOrder.clear();
+    for (JunctionID id: visibleJunctions)
+        labelOrder.push_back({ id, maze->GetJunctionCoord(id) });
+    sort(labelOrder.begin(), labelOrder.end(), [](JunctionCoord &a, JunctionCoord &b) {
+        return a.coord.y != b.coord.y ? a.coord.y > b.coord.y : a.coord.x > b.coord.x;
+    });
+
+    int gridWidth = labelScreenWidth / LABEL_GRID_SIZE + 1;
+    int gridHeight = labelScreenHeight / LABEL_GRID_SIZE + 1;
+    labelGrid.resize(gridWidth * gridHeight);
+    for (vector<Rectangle> &cell: labelGrid)
+        cell.clear();
+    placedLabels.clear();
+
+    Rectangle screen = { 0, 0, (float)labelScreenWidth, (float)labelScreenHeight };
+    Matrix camera = GetCameraMatrix2D(arcGlobal.camera);
+    for (JunctionCoord &jc: labelOrder) {
+        JunctionID id = jc.id;
+        Rectangle rect = GetJunctionRect(id);
+        Vector2 tilePos = Vector2Transform({ rect.x, rect.y }, camera);
+        Vector2 targetPos = Vector2Transform({ rect.x - 5, rect.y - 5 }, camera);
+        // Every box holds the corner at its target, most labels are turned
+        // away before their name is looked up.
+        if (!LabelFits({ targetPos.x - 1, targetPos.y, 1, 1 }, gridWidth, gridHeight))
+            continue;
+
+        LabelLayout &layout = GetLabelLayout(maze->GetJunctionName(id));
+        Vector2 textPos = { floorf(targetPos.x - layout.width), floorf(targetPos.y - fontSize - w) };
+        Rectangle box = { textPos.x - 3, textPos.y, targetPos.x - textPos.x + 3, targetPos.y + w - textPos.y };
+        if (!CheckCollisionRecs(box, screen) || !LabelFits(box, gridWidth, gridHeight))
+            continue;
+        PlaceLabel(box, gridWidth, gridHeight);
+        placedLabels.push_back({ tilePos, targetPos, textPos, &layout });
+    }
+}
+LabelLayout &MazeRenderer::GetLabelLayout(const string &text)
+{
+    // The glyph quads DrawText() would draw for the text at fontSize,
+    // relative to the top left corner of the label.
+    auto it = labelLayouts.find(text);
+    if (it != labelLayouts.end())
+        return it->second;
+    LabelLayout &layout = labelLayouts[text];
+
+    int size = max(fontSize, 10);
+    float scale = (float)size / raylibFont.baseSize;
+    float spacing = size / 10;
+    float padding = raylibFont.glyphPadding;
+    float x = 0;
+    for (int i = 0; i < text.size();) {
+        int bytes = 0;
+        int codepoint = GetCodepointNext(&text[i], &bytes);
+        int index = GetGlyphIndex(raylibFont, codepoint);
+        Rectangle r = raylibFont.recs[index];
+        GlyphInfo &glyph = raylibFont.glyphs[index];
+        if (codepoint != ' ' && codepoint != '\t') {
+            LabelGlyph quad;
+            quad.source = { r.x - padding, r.y - padding, r.width + 2*padding, r.height + 2*padding };
+            quad.dest = { x + (glyph.offsetX - padding)*scale, (glyph.offsetY - padding)*scale,
+                (r.width + 2*padding)*scale, (r.height + 2*padding)*scale };
+            layout.glyphs.push_back(quad);
+        }
+        x += (glyph.advanceX != 0 ? glyph.advanceX : r.width)*scale + spacing;
+        i += bytes;
+    }
+    layout.width = text.empty() ? 0 : x - spacing;
+    return layout;
+}
+bool MazeRenderer::LabelFits(Rectangle box, int gridWidth, int gridHeight)
+{
+    // Whether the box is clear of the labels placed so far.
+    int x0 = Clamp(floorf(box.x / LABEL_GRID_SIZE), 0, gridWidth-1);
+    int y0 = Clamp(floorf(box.y / LABEL_GRID_SIZE), 0, gridHeight-1);
+    int x1 = Clamp(floorf((box.x + box.width) / LABEL_GRID_SIZE), 0, gridWidth-1);
+    int y1 = Clamp(floorf((box.y + box.height) / LABEL_GRID_SIZE), 0, gridHeight-1);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            for (Rectangle &other: labelGrid[y*gridWidth + x]) {
+                if (CheckCollisionRecs(box, other))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+void MazeRenderer::PlaceLabel(Rectangle box, int gridWidth, int gridHeight)
+{
+    int x0 = Clamp(floorf(box.x / LABEL_GRID_SIZE), 0, gridWidth-1);
+    int y0 = Clamp(floorf(box.y / LABEL_GRID_SIZE), 0, gridHeight-1);
+    int x1 = Clamp(floorf((box.x + box.width) / LABEL_GRID_SIZE), 0, gridWidth-1);
+    int y1 = Clamp(floorf((box.y + box.height) / LABEL_GRID_SIZE), 0, gridHeight-1);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++)
+            labelGrid[y*gridWidth + x].push_back(box);
+    }
 }
 
 Rectangle MazeRenderer::GetJunctionRect(JunctionID id)
@@ -4,11 +4,166 @@
 #include "maze.h"
 #include "arclib.h"
 
+// Tunnels and junctions are turned into meshes per square chunk of cells,
+// which stay on the GPU until the maze journal has a change under them.
+#define RENDER_CHUNK_BITS 6
+#define RENDER_CHUNK_SIZE (1 << RENDER_CHUNK_BITS)
+// Chunks kept around when out of view.
+#define RENDER_CHUNK_CACHE 4096
+// Seconds a layer may spend building chunks per frame. Chunks left over
+// keep their old geometry, or none, until a later frame.
+#define RENDER_BUILD_BUDGET 0.004
+
+enum RenderLayer {
+    LAYER_TUNNELS,
+    LAYER_FILLS,
+    LAYER_OUTLINES,
+    LAYER_COUNT
+};
+
+struct RenderChunk {
+    bool built = false;
+    bool stale = false;
+    uint64_t lastDraw = 0;
+    Mesh layers[LAYER_COUNT] = {};
+};
+
+// The id and tag overlays are drawn into a texture per square chunk of
+// cells, redrawn when the grid block under it changes or the zoom moves on.
+#define OVERLAY_CHUNK_BITS 4
+#define OVERLAY_CHUNK_SIZE (1 << OVERLAY_CHUNK_BITS)
+// Pixels past the chunk for text running over its right and bottom edge.
+#define OVERLAY_MARGIN 96
+// Textures have at most this many pixels per world unit, closer in they
+// are scaled up.
+#define OVERLAY_MAX_SCALE 4.0f
+#define OVERLAY_CACHE 32
+
+enum OverlayKind {
+    OVERLAY_IDS,
+    OVERLAY_TAGS,
+    OVERLAY_COUNT
+};
+
+struct OverlayChunk {
+    RenderTexture2D texture = {};
+    bool built = false;
+    uint64_t revision = 0;
+    float scale = 0;
+    uint64_t lastDraw = 0;
+};
+
+// Zoomed out past LOD_ZOOM the maze is drawn from a pyramid of density
+// textures instead of the chunk meshes. A level 0 tile is a grid block
+// with a texel per cell, every level up halves the resolution, and the
+// level drawn has a texel or a bit more per pixel.
+#define LOD_ZOOM 0.2f
+#define LOD_TILE_BITS GRID_CHUNK_BITS
+#define LOD_TILE_SIZE (1 << LOD_TILE_BITS)
+#define LOD_LEVELS 16
+// Tiles kept in memory, 8 KB each plus their textures.
+#define LOD_CACHE 16384
+
+enum LodLayer {
+    LOD_TUNNELS,
+    LOD_JUNCTIONS,
+    LOD_LAYER_COUNT
+};
+
+struct LodTile {
+    // Level 0 tiles keep the revisions of their block, the others the
+    // newest build of their children, to see when to build again.
+    uint64_t idRevision = 0;
+    uint64_t tunnelRevision = 0;
+    uint64_t childBuild = 0;
+    uint64_t build = 0;
+    // Maze version the whole tile was last seen up to date at.
+    uint64_t version = 0;
+    uint64_t lastDraw = 0;
+    // Share of every texel covered by the layer, 0 to 255.
+    vector<uint8_t> density[LOD_LAYER_COUNT];
+    Texture2D textures[LOD_LAYER_COUNT] = {};
+    bool uploaded[LOD_LAYER_COUNT] = {};
+};
+
+// Junction labels are laid out once per name as quads into the font
+// atlas, and drawn only where they do not cover a label drawn before.
+// Placed labels are looked up by cells of this many screen pixels.
+#define LABEL_GRID_SIZE 64
+// Layouts kept before the cache starts over.
+#define LABEL_CACHE 65536
+
+struct LabelGlyph {
+    Rectangle source;
+    Rectangle dest;
+};
+
+struct LabelLayout {
+    float width = 0;
+    vector<LabelGlyph> glyphs;
+};
+
+struct PlacedLabel {
+    Vector2 tilePos;
+    Vector2 targetPos;
+    Vector2 textPos;
+    LabelLayout *layout;
+};
+
 class MazeRenderer
 {
 private:
     Maze *maze = nullptr;
     Font raylibFont;
+    // Reused between frames, filled with what the camera sees.
+    vector<JunctionID> visibleJunctions;
+    vector<Tunnel> visibleTunnels;
+
+    // Lines are quads widened in the vertex shader, never thinner than a
+    // pixel. Fills have no width.
+    Shader lineShader = {};
+    Material lineMaterial = {};
+    int minWidthLoc = -1;
+    int halfWidthLoc = -1;
+    unordered_map<CoordID, RenderChunk, CoordHash> chunks;
+    // Maze version the chunks were marked up to, and the changes since.
+    uint64_t chunkVersion = 0;
+    vector<MazeChange> changes;
+    unordered_map<CoordID, OverlayChunk, CoordHash> overlays[OVERLAY_COUNT];
+    uint64_t drawCount = 0;
+    unordered_map<CoordID, LodTile, CoordHash> lods[LOD_LEVELS];
+    uint64_t lodBuilds = 0;
+    unordered_map<string, LabelLayout> labelLayouts;
+    int labelFontSize = 0;
+    vector<JunctionCoord> labelOrder;
+    vector<PlacedLabel> placedLabels;
+    vector<vector<Rectangle>> labelGrid;
+    // What the placed labels were laid out for, kept while nothing moves.
+    Camera2D labelCamera = {};
+    uint64_t labelVersion = 0;
+    int labelScreenWidth = 0;
+    int labelScreenHeight = 0;
+
+    void GetVisibleCells(float margin, Coord &lo, Coord &hi);
+    void BuildChunk(RenderChunk &chunk, int cx, int cy);
+    void UnloadChunk(RenderChunk &chunk);
+    void UnloadChunks();
+    void SyncChunks();
+    void DrawLayer(RenderLayer layer, Color color, float halfWidth);
+    void BuildOverlay(OverlayKind kind, OverlayChunk &chunk, int cx, int cy, float scale);
+    void UnloadOverlays();
+    void DrawOverlay(OverlayKind kind);
+    void DrawIdCell(int gx, int gy, Vector2 pos);
+    void DrawTagCell(int gx, int gy, Vector2 pos);
+    LodTile *UpdateLod(int level, int tx, int ty, double deadline, bool &complete);
+    void BuildLod(LodTile &tile, int tx, int ty);
+    void MergeLod(LodTile &tile, LodTile *children[4]);
+    void UnloadLods();
+    bool DrawLod(LodLayer layer, Color color);
+    void PlaceLabels();
+    LabelLayout &GetLabelLayout(const string &text);
+    bool LabelFits(Rectangle box, int gridWidth, int gridHeight);
+    void PlaceLabel(Rectangle box, int gridWidth, int gridHeight);
 
 public:
     Color junctionColor = { 15, 255, 0, 255 };
@@ -21,6 +176,7 @@ public:
     int fontSize = 20;
 
     MazeRenderer();
+    ~MazeRenderer();
     void SetMaze(Maze *_maze);
 
     void DrawJunctionLabels();
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstdlib>
+#include "maze_router.h"
+
+MazeRouter::MazeRouter()
+{
+}
+void MazeRouter::SetGraph(MazeGraph *_graph)
+{
+    graph = _graph;
+    uint32_t n = graph->Size();
+    if (dist.size() < n) {
+        dist.resize(n);
+        parent.resize(n);
+        stamp.resize(n, 0);
+    }
+}
+void MazeRouter::BeginQuery()
+{
+    heap.clear();
+    settled.clear();
+    query++;
+    if (query == 0) {
+        // Stamps wrapped around, everything left over might look valid.
+        fill(stamp.begin(), stamp.end(), 0);
+        query = 1;
+    }
+}
+void MazeRouter::Relax(uint32_t node, uint32_t d, uint32_t from, uint32_t key)
+{
+    if (stamp[node] == query && dist[node] <= d)
+        return;
+    stamp[node] = query;
+    dist[node] = d;
+    parent[node] = from;
+    heap.push_back({ key, node });
+    push_heap(heap.begin(), heap.end());
+}
+uint32_t MazeRouter::Heuristic(uint32_t node, uint32_t target)
+{
+    // Tunnels are straight, so no path is shorter than the Manhattan distance.
+    if (!useHeuristic)
+        return 0;
+    Coord a = graph->coords[node];
+    Coord b = graph->coords[target];
+    return abs(a.x - b.x) + abs(a.y - b.y);
+}
+
+uint32_t MazeRouter::FindPath(JunctionID from, JunctionID to, vector<JunctionID> &path, bool heuristic)
+{
+    path.clear();
+    useHeuristic = heuristic;
+    uint32_t source = graph->GetIndex(from);
+    uint32_t target = graph->GetIndex(to);
+    if (source == GRAPH_NONE || target == GRAPH_NONE)
+        return ROUTE_INFINITY;
+
+    BeginQuery();
+    Relax(source, 0, GRAPH_NONE, Heuristic(source, target));
+    bool found = false;
+    while (heap.size() > 0) {
+        pop_heap(heap.begin(), heap.end());
+        HeapItem item = heap.back();
+        heap.pop_back();
+
+        // Skip entries that were improved after they were pushed.
+        uint32_t node = item.node;
+        if (item.key > dist[node] + Heuristic(node, target))
+            continue;
+        if (node == target) {
+            found = true;
+            break;
+        }
+
+        for (uint32_t k = graph->offsets[node]; k < graph->offsets[node+1]; k++) {
+            uint32_t next = graph->neighbors[k];
+            uint32_t d = dist[node] + graph->lengths[k];
+            Relax(next, d, node, d + Heuristic(next, target));
+        }
+    }
+    if (!found)
+        return ROUTE_INFINITY;
+
+    for (uint32_t node = target; node != GRAPH_NONE; node = parent[node])
+        path.push_back(graph->ids[node]);
+    reverse(path.begin(), path.end());
+    return dist[target];
+}
+void MazeRouter::FindAll(uint32_t source)
+{
+    BeginQuery();
+    if (source >= graph->Size())
+        return;
+
+    Relax(source, 0, GRAPH_NONE, 0);
+    while (heap.size() > 0) {
+        pop_heap(heap.begin(), heap.end());
+        HeapItem item = heap.back();
+        heap.pop_back();
+
+        uint32_t node = item.node;
+        if (item.key > dist[node])
+            continue;
+        settled.push_back(node);
+        for (uint32_t k = graph->offsets[node]; k < graph->offsets[node+1]; k++) {
+            uint32_t next = graph->neighbors[k];
+            uint32_t d = dist[node] + graph->lengths[k];
+            Relax(next, d, node, d);
+        }
+    }
+}
+uint32_t MazeRouter::GetDistance(uint32_t index)
+{
+    if (stamp[index] != query)
+        return ROUTE_INFINITY;
+    return dist[index];
+}
+uint32_t MazeRouter::GetParent(uint32_t index)
+{
+    if (stamp[index] != query)
+        return GRAPH_NONE;
+    return parent[index];
+}
+const vector<uint32_t> &MazeRouter::GetSettled()
+{
+    return settled;
+}
@@ -0,0 +1,58 @@
+#ifndef MAZE_ROUTER_H
+#define MAZE_ROUTER_H
+
+#include <cstdint>
+#include <vector>
+#include "maze_graph.h"
+
+using namespace std;
+
+#define ROUTE_INFINITY UINT32_MAX
+
+// Shortest paths over a MazeGraph, with the Manhattan tunnel lengths as
+// edge weights. Point to point queries run A*, single source queries run
+// Dijkstra. The heap and the scratch arrays are kept between queries and
+// only grow when the graph does, so repeated queries do not allocate.
+class MazeRouter {
+private:
+    struct HeapItem {
+        uint32_t key;
+        uint32_t node;
+        bool operator<(const HeapItem &other) const { return key > other.key; }
+    };
+
+    MazeGraph *graph = nullptr;
+    vector<HeapItem> heap;
+    vector<uint32_t> dist;
+    vector<uint32_t> parent;
+    vector<uint32_t> settled;
+
+    // Entries of dist and parent are only valid when their stamp matches
+    // the current query, which saves clearing them for every query.
+    vector<uint32_t> stamp;
+    uint32_t query = 0;
+    bool useHeuristic = true;
+
+    void BeginQuery();
+    void Relax(uint32_t node, uint32_t d, uint32_t from, uint32_t key);
+    uint32_t Heuristic(uint32_t node, uint32_t target);
+
+public:
+    MazeRouter();
+    void SetGraph(MazeGraph *_graph);
+
+    // A* between two junctions. Fills path from start to end and returns
+    // the length, or ROUTE_INFINITY when they are not connected. Without
+    // the heuristic this is plain Dijkstra stopping at the target.
+    uint32_t FindPath(JunctionID from, JunctionID to, vector<JunctionID> &path, bool heuristic = true);
+
+    // Dijkstra from a junction index to every junction. Query the results
+    // with GetDistance and GetParent until the next search. GetSettled lists
+    // the reached junctions by increasing distance.
+    void FindAll(uint32_t source);
+    uint32_t GetDistance(uint32_t index);
+    uint32_t GetParent(uint32_t index);
+    const vector<uint32_t> &GetSettled();
+};
+
+#endif
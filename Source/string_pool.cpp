@@ -0,0 +1,48 @@
+#include "string_pool.h"
+
+StringPool::StringPool()
+{
+    Intern("");
+}
+StringPool::StringPool(const StringPool &other)
+: strings(other.strings)
+{
+    Rebuild();
+}
+StringPool &StringPool::operator=(const StringPool &other)
+{
+    strings = other.strings;
+    Rebuild();
+    return *this;
+}
+void StringPool::Rebuild()
+{
+    // The keys view the strings they belong to, a copy needs its own.
+    handles.clear();
+    for (StringHandle h = 0; h < strings.size(); h++)
+        handles[strings[h]] = h;
+}
+
+StringHandle StringPool::Intern(string_view s)
+{
+    auto it = handles.find(s);
+    if (it != handles.end())
+        return it->second;
+    StringHandle h = strings.size();
+    strings.emplace_back(s);
+    handles[strings.back()] = h;
+    return h;
+}
+StringHandle StringPool::Find(string_view s)
+{
+    auto it = handles.find(s);
+    return it != handles.end() ? it->second : STRING_NONE;
+}
+const string &StringPool::Get(StringHandle handle)
+{
+    return strings[handle];
+}
+size_t StringPool::Size()
+{
+    return strings.size();
+}
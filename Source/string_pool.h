@@ -0,0 +1,40 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+typedef uint32_t StringHandle;
+
+#define STRING_NONE UINT32_MAX
+
+// Interned strings. Every distinct string is stored once and referred to
+// by a small handle, handle 0 is the empty string. Strings are never
+// removed, so references and views stay valid as long as the pool does.
+class StringPool {
+private:
+    deque<string> strings;
+    unordered_map<string_view, StringHandle> handles;
+
+    void Rebuild();
+
+public:
+    StringPool();
+    StringPool(const StringPool &other);
+    StringPool(StringPool &&other) = default;
+    StringPool &operator=(const StringPool &other);
+    StringPool &operator=(StringPool &&other) = default;
+
+    StringHandle Intern(string_view s);
+    // STRING_NONE when the string was never interned.
+    StringHandle Find(string_view s);
+    const string &Get(StringHandle handle);
+    size_t Size();
+};
+
+#endif
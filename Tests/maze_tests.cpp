@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+#include "../Source/maze.h"
+#include "../Source/generation_task.h"
+
+// Regression tests of the maze core, run by ctest from the source
+// directory. Every failed check is printed, the exit code counts them.
+
+static int failures = 0;
+
+// A copy would share the name index of the maze it came from.
+static_assert(!is_copy_constructible_v<Maze> && !is_copy_assignable_v<Maze>);
+static_assert(is_move_constructible_v<Maze> && is_move_assignable_v<Maze>);
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static void TestDuplicateId()
+{
+    // The repeated ID keeps the first junction, all of it.
+    Maze maze;
+    maze.verbose = false;
+    CHECK(maze.ImportJson("Tests/duplicate_id.json"));
+    CHECK(maze.id_to_junction.size() == 2);
+    CHECK(maze.GetJunctionName(7) == "A");
+    CHECK(maze.GetJunctionCoord(7) == Coord(0, 0));
+    CHECK(maze.GetJunctionAt(0, 5) == 0);
+    CHECK(maze.GetJunctionAt(1, 6) == 0);
+    CHECK(maze.FindJunction("C") == 0);
+    CHECK(maze.FindJunction("A") == 7);
+
+    vector<string> conflicts = maze.Validate();
+    CHECK(conflicts.size() == 1);
+    CHECK(conflicts.size() > 0 && conflicts[0] == "Junction 7 appears more than once");
+
+    // A checked import rejects the file and keeps the maze it had.
+    Maze checked;
+    checked.verbose = false;
+    CHECK(checked.ImportJson("Examples/test.json", true));
+    size_t junctions = checked.id_to_junction.size();
+    CHECK(!checked.ImportJson("Tests/duplicate_id.json", true));
+    CHECK(checked.id_to_junction.size() == junctions);
+    CHECK(checked.name == "Test Maze");
+}
+
+static void TestDuplicateTunnel()
+{
+    // The reversed tunnel, the loop and the tunnel to a missing junction
+    // are left out, the tunnel index only has what tunnel_map has.
+    Maze maze;
+    maze.verbose = false;
+    CHECK(maze.ImportJson("Tests/duplicate_tunnel.json"));
+    CHECK(maze.GetTunnelList().size() == 2);
+    CHECK(maze.tunnel_map.count(9) == 0);
+    CHECK(maze.tunnel_map[3].count(3) == 0);
+
+    vector<string> conflicts = maze.Validate();
+    CHECK(conflicts.size() == 3);
+    CHECK(conflicts.size() == 3 && conflicts[0] == "Tunnel 2-1 appears more than once");
+    CHECK(conflicts.size() == 3 && conflicts[1] == "Tunnel 3-3 connects a junction to itself");
+    CHECK(conflicts.size() == 3 && conflicts[2] == "Tunnel 3-9 connects a missing junction");
+
+    // Nothing of the tunnel is left behind once it is removed.
+    maze.RemoveTunnel({ 1, 2 });
+    CHECK(!maze.TunnelExists({ 1, 2 }));
+    CHECK(maze.GetTunnelAt(2, 0).from == 0);
+    maze.AddJunction(2, 0, "D");
+    CHECK(!maze.TunnelExists({ 1, 2 }));
+    CHECK(maze.GetTunnelList().size() == 1);
+
+    Maze checked;
+    checked.verbose = false;
+    CHECK(!checked.ImportJson("Tests/duplicate_tunnel.json", true));
+}
+
+static void TestGenerateColumn()
+{
+    // With a width of 1 every tunnel is vertical, none may run through
+    // the junction already between two grid points.
+    Maze maze;
+    maze.verbose = false;
+    maze.AddJunction(0, 2, "X", 1000);
+    MazeGeneratorSettings settings;
+    settings.width = 1;
+    settings.height = 4;
+    GenerationTask task;
+    CHECK(task.Start(maze, settings));
+    while (task.Step(maze, 1.0))
+        ;
+    JunctionID top = maze.GetJunctionAt(0, 0);
+    JunctionID below = maze.GetJunctionAt(0, 4);
+    CHECK(top != 0 && below != 0);
+    CHECK(!maze.TunnelExists({ top, below }));
+    CHECK(maze.TunnelExists({ below, maze.GetJunctionAt(0, 8) }));
+    CHECK(maze.GetJunctionAt(0, 2) == 1000);
+}
+
+static void TestGenerateAcross()
+{
+    // A generated tunnel may not run through a junction or across a
+    // tunnel that lies between two grid points.
+    MazeGeneratorSettings settings;
+    settings.width = 2;
+    settings.height = 1;
+    Maze maze;
+    maze.verbose = false;
+    maze.AddJunction(2, 0, "X", 1000);
+    CHECK(!MazeGenerator(settings).Generate(maze));
+    CHECK(maze.id_to_junction.size() == 1);
+
+    Maze crossed;
+    crossed.verbose = false;
+    crossed.AddJunction(2, -2, "X", 1000);
+    crossed.AddJunction(2, 2, "Y", 1001);
+    crossed.AddTunnel(1000, 1001);
+    CHECK(!MazeGenerator(settings).Generate(crossed));
+    CHECK(crossed.id_to_junction.size() == 2);
+
+    settings.origin = Coord(10, 0);
+    CHECK(MazeGenerator(settings).Generate(crossed));
+    CHECK(crossed.id_to_junction.size() == 4);
+}
+
+static string ReadFile(fs::path path)
+{
+    ifstream file(path);
+    stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+static void TestExportOrder()
+{
+    // The same maze built in another order exports the same file.
+    Maze forward, backward;
+    forward.verbose = backward.verbose = false;
+    vector<string> tags = { "loot" };
+    for (int i = 0; i < 50; i++)
+        forward.AddJunction(i*3, 0, "J" + to_string(i), 100 + i);
+    for (int i = 49; i >= 0; i--)
+        backward.AddJunction(i*3, 0, "J" + to_string(i), 100 + i);
+    for (int i = 0; i < 49; i++) {
+        forward.AddTunnel(100 + i, 101 + i);
+        backward.AddTunnel(149 - i, 148 - i);
+        forward.SetTagsAt(i*3 + 1, 0, tags);
+        backward.SetTagsAt((48 - i)*3 + 1, 0, tags);
+    }
+    fs::path a = fs::temp_directory_path() / "maze_tests_forward.json";
+    fs::path b = fs::temp_directory_path() / "maze_tests_backward.json";
+    CHECK(forward.ExportJson(a) && backward.ExportJson(b));
+    CHECK(ReadFile(a) == ReadFile(b));
+    fs::remove(a);
+    fs::remove(b);
+}
+
+static void TestRemoveMissingTunnel()
+{
+    // Removing a tunnel that is not there is not an edit.
+    Maze maze;
+    maze.verbose = false;
+    maze.AddJunction(0, 0, "A", 1);
+    maze.AddJunction(5, 0, "B", 2);
+    uint64_t version = maze.version;
+    maze.RemoveTunnel({ 1, 2 });
+    maze.RemoveTunnel({ 3, 4 });
+    CHECK(maze.version == version);
+    CHECK(maze.tunnel_map.count(3) == 0 && maze.tunnel_map.count(4) == 0);
+
+    maze.AddTunnel(1, 2);
+    maze.RemoveTunnel({ 2, 1 });
+    CHECK(!maze.TunnelExists({ 1, 2 }) && !maze.TunnelExists({ 2, 1 }));
+    CHECK(maze.GetTunnelAt(3, 0).from == 0);
+    CHECK(maze.version == version + 2);
+}
+
+int main()
+{
+    TestDuplicateId();
+    TestDuplicateTunnel();
+    TestGenerateColumn();
+    TestGenerateAcross();
+    TestExportOrder();
+    TestRemoveMissingTunnel();
+    if (failures > 0)
+        printf("%d checks failed\n", failures);
+    else
+        printf("All checks passed\n");
+    return failures;
+}
@@ -0,0 +1,43 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "../Source/maze.h"
+#include "../Source/maze_graph.h"
+#include "../Source/distance_table.h"
+
+// Builds the all pairs distance table of a maze and saves it, to be
+// memory mapped by whatever needs the distances at runtime.
+//
+// Usage: MazeDistances <maze> <table.mzd> [threads]
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("Usage: %s <maze> <table.mzd> [threads]\n", argv[0]);
+        return 1;
+    }
+    fs::path input = argv[1];
+    fs::path output = argv[2];
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+
+    Maze maze;
+    bool loaded = input.extension() == ".mzb" ? maze.ImportBinary(input) : maze.ImportJson(input);
+    if (!loaded) {
+        printf("Could not load %s\n", input.string().c_str());
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    MazeGraph graph(maze);
+    DistanceTable table;
+    if (!table.Build(graph, threads))
+        return 1;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("Built %u x %u table in %.2fs\n", table.Size(), table.Size(), seconds);
+
+    if (!table.Save(output)) {
+        printf("Could not write %s\n", output.string().c_str());
+        return 1;
+    }
+    return 0;
+}
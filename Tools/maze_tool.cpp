@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <nlohmann/json.hpp>
+#include "../Source/maze.h"
+#include "../Source/maze_graph.h"
+#include "../Source/maze_router.h"
+
+// Headless batch processing of maze files, without raylib or ImGui.
+// Files are spread over a pool of workers. A worker loads one maze at a
+// time and drops it before taking the next, so memory stays bounded by
+// the largest mazes times the number of workers.
+//
+// Usage: MazeTool <command> [options] <mazes...>
+//   validate              Report conflicts, fails on any.
+//   prune                 Prune colinear and loose junctions, see -o.
+//   convert -f json|mzb   Convert to the given format, see -o.
+//   stats                 Counts, extent, degrees and components.
+//   route <from> <to>     Shortest route between two junctions, by name
+//                         or by id.
+// Options:
+//   -j <threads>          Files processed at once, all cores by default.
+//   -o <dir>              Output directory, otherwise next to the input.
+//                         Without it prune overwrites its input.
+
+struct Options {
+    string command;
+    string format;
+    fs::path outDir;
+    int threads = 0;
+    string from;
+    string to;
+    vector<fs::path> files;
+};
+
+static bool IsBinaryPath(fs::path path)
+{
+    return path.extension() == ".mzb";
+}
+
+static void Appendf(string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    out += buf;
+}
+
+static fs::path OutputPath(Options &opt, fs::path input, string extension)
+{
+    fs::path dir = opt.outDir.empty() ? input.parent_path() : opt.outDir;
+    return dir / input.filename().replace_extension(extension);
+}
+
+static JunctionID LookupJunction(Maze &maze, string key)
+{
+    // Ids first, a junction may well be named after a number.
+    char *end;
+    unsigned long id = strtoul(key.c_str(), &end, 10);
+    if (*end == '\0' && key.size() > 0 && maze.JunctionExists(id))
+        return id;
+    return maze.FindJunction(key);
+}
+
+static bool RunStats(Maze &maze, string &out)
+{
+    MazeGraph graph(maze);
+    uint32_t n = graph.Size();
+    uint64_t totalLength = 0;
+    uint32_t maxDegree = 0;
+    uint32_t deadEnds = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        maxDegree = max(maxDegree, graph.Degree(i));
+        deadEnds += graph.Degree(i) == 1;
+    }
+    for (uint32_t length: graph.lengths)
+        totalLength += length;
+
+    Coord lo = n > 0 ? graph.coords[0] : Coord(0, 0);
+    Coord hi = lo;
+    for (Coord c: graph.coords) {
+        lo = { min(lo.x, c.x), min(lo.y, c.y) };
+        hi = { max(hi.x, c.x), max(hi.y, c.y) };
+    }
+
+    // Components by flooding from every junction not reached yet.
+    MazeRouter router;
+    router.SetGraph(&graph);
+    vector<char> reached(n, 0);
+    uint32_t components = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (reached[i])
+            continue;
+        components++;
+        router.FindAll(i);
+        for (uint32_t node: router.GetSettled())
+            reached[node] = 1;
+    }
+
+    Appendf(out, "  name        \"%s\"\n", maze.name.c_str());
+    Appendf(out, "  junctions   %u\n", n);
+    Appendf(out, "  tunnels     %zu (length %llu)\n", graph.neighbors.size() / 2, (unsigned long long)totalLength / 2);
+    Appendf(out, "  tagged      %zu cells\n", maze.coord_to_tags.Size());
+    Appendf(out, "  extent      (%d, %d) to (%d, %d)\n", lo.x, lo.y, hi.x, hi.y);
+    Appendf(out, "  degree      max %u, %u dead ends\n", maxDegree, deadEnds);
+    Appendf(out, "  components  %u\n", components);
+    return true;
+}
+
+static bool RunRoute(Options &opt, Maze &maze, string &out)
+{
+    JunctionID from = LookupJunction(maze, opt.from);
+    JunctionID to = LookupJunction(maze, opt.to);
+    if (from == 0 || to == 0) {
+        Appendf(out, "  no junction %s\n", from == 0 ? opt.from.c_str() : opt.to.c_str());
+        return false;
+    }
+    MazeGraph graph(maze);
+    MazeRouter router;
+    router.SetGraph(&graph);
+    vector<JunctionID> path;
+    uint32_t length = router.FindPath(from, to, path);
+    if (length == ROUTE_INFINITY) {
+        Appendf(out, "  no route\n");
+        return false;
+    }
+    Appendf(out, "  length %u over %zu junctions\n ", length, path.size());
+    for (JunctionID id: path) {
+        const string &name = maze.GetJunctionName(id);
+        if (name.size() > 0)
+            Appendf(out, " %s", name.c_str());
+        else
+            Appendf(out, " %u", id);
+    }
+    out += "\n";
+    return true;
+}
+
+static bool ProcessFile(Options &opt, fs::path input, string &out)
+{
+    Appendf(out, "%s\n", input.string().c_str());
+    Maze maze;
+    maze.verbose = false;
+    // A malformed file throws from the JSON parser. It fails only this
+    // file, the rest of the batch goes on.
+    bool loaded = false;
+    try {
+        loaded = IsBinaryPath(input) ? maze.ImportBinary(input) : maze.ImportJson(input);
+    } catch (nlohmann::json::exception &e) {
+        Appendf(out, "  %s\n", e.what());
+    } catch (exception &e) {
+        Appendf(out, "  %s\n", e.what());
+    }
+    if (!loaded) {
+        Appendf(out, "  could not load %s\n", input.string().c_str());
+        return false;
+    }
+
+    if (opt.command == "validate") {
+        vector<string> conflicts = maze.Validate();
+        for (string &c: conflicts)
+            Appendf(out, "  %s\n", c.c_str());
+        Appendf(out, "  %zu conflicts\n", conflicts.size());
+        return conflicts.size() == 0;
+    }
+    if (opt.command == "prune") {
+        size_t before = maze.id_to_junction.size();
+        maze.PruneJunctions();
+        fs::path output = OutputPath(opt, input, input.extension().string());
+        bool saved = IsBinaryPath(output) ? maze.ExportBinary(output) : maze.ExportJson(output);
+        Appendf(out, "  pruned %zu junctions into %s\n", before - maze.id_to_junction.size(), output.string().c_str());
+        return saved;
+    }
+    if (opt.command == "convert") {
+        fs::path output = OutputPath(opt, input, "." + opt.format);
+        bool saved = IsBinaryPath(output) ? maze.ExportBinary(output) : maze.ExportJson(output);
+        Appendf(out, "  %s %s\n", saved ? "written" : "could not write", output.string().c_str());
+        return saved;
+    }
+    if (opt.command == "stats")
+        return RunStats(maze, out);
+    return RunRoute(opt, maze, out);
+}
+
+static bool ParseOptions(int argc, char **argv, Options &opt)
+{
+    if (argc < 2)
+        return false;
+    opt.command = argv[1];
+    vector<string> positional;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+            opt.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            opt.outDir = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i+1 < argc)
+            opt.format = argv[++i];
+        else
+            positional.push_back(argv[i]);
+    }
+
+    int skip = 0;
+    if (opt.command == "route") {
+        if (positional.size() < 2)
+            return false;
+        opt.from = positional[0];
+        opt.to = positional[1];
+        skip = 2;
+    } else if (opt.command == "convert") {
+        if (opt.format != "json" && opt.format != "mzb")
+            return false;
+    } else if (opt.command != "validate" && opt.command != "prune" && opt.command != "stats") {
+        return false;
+    }
+    for (int i = skip; i < positional.size(); i++)
+        opt.files.push_back(positional[i]);
+    return opt.files.size() > 0;
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!ParseOptions(argc, argv, opt)) {
+        printf("Usage: %s <command> [options] <mazes...>\n", argv[0]);
+        printf("  validate | prune | convert -f json|mzb | stats | route <from> <to>\n");
+        printf("  -j <threads>  files processed at once\n");
+        printf("  -o <dir>      output directory for prune and convert\n");
+        return 1;
+    }
+    if (!opt.outDir.empty())
+        fs::create_directories(opt.outDir);
+
+    // Reports are printed whole, in order of completion.
+    atomic<size_t> next = 0;
+    atomic<int> failed = 0;
+    mutex printLock;
+    auto work = [&]() {
+        for (size_t i = next++; i < opt.files.size(); i = next++) {
+            string out;
+            if (!ProcessFile(opt, opt.files[i], out))
+                failed++;
+            lock_guard<mutex> lock(printLock);
+            fputs(out.c_str(), stdout);
+        }
+    };
+    int threads = opt.threads > 0 ? opt.threads : max(1u, thread::hardware_concurrency());
+    threads = min(threads, (int)opt.files.size());
+    vector<thread> workers;
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(work);
+    work();
+    for (thread &t: workers)
+        t.join();
+
+    if (failed > 0)
+        printf("%d of %zu files failed\n", (int)failed, opt.files.size());
+    return failed > 0 ? 1 : 0;
+}